@@ -25,42 +25,78 @@
 #include <X11/Xlibint.h>
 #include <X11/extensions/Xrandr.h>
 #include <X11/Xatom.h>
+#include <X11/Xlib-xcb.h>
+#include <xcb/randr.h>
 #include <stdint.h>
 #include <string.h>
+#include <strings.h>
 #include <malloc.h>
 #include <math.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
 #include "include/common.h"
 #include "include/misc.h"
+#include "include/config.h"
+#include "include/gamma.h"
 #include "include/brightness.h"
+#include "include/probe.h"
+#include "include/cache.h"
+#include "include/sysfs.h"
+#include "include/ddc.h"
 
 
 static bool get_brightness_state(void);
+static bool ddc_update(void);
 
 struct monitor_data {
     RROutput output;
     RRCrtc crtc;
-    bool supported_methods[3];
+    uint64_t edid_hash;
+    bool supported_methods[METHOD_COUNT];
     enum method current_method;
     Atom backlight_atom;
-    uint32_t min[3];                /* Min backlight level */
-    uint32_t max[3];                /* Max backlight level */
-    uint32_t level[3];              /* Current backlight level */
-    float normalised_level[3];      /* level, in [0, 1] */
+    struct sysfs_backlight *sysfs;  /* Kernel backlight device, or NULL */
+    struct ddc_bus *ddc;            /* DDC/CI bus of the monitor, or NULL */
+    enum method preferred_method;   /* Last picked by the user, or NONE */
+    uint32_t min[5];                /* Min backlight level */
+    uint32_t max[5];                /* Max backlight level */
+    uint32_t level[5];              /* Current backlight level */
+    bool backlight_changed;         /* Server reported a new backlight level */
+    float normalised_level[5];      /* level, in [0, 1] */
     float actual_level;             /* normalised + global boost */
     float gamma_red, gamma_green, gamma_blue;
     int gamma_size;
     XRRCrtcGamma *gamma;
-    XRRCrtcGamma **gamma_precalc;
-    uint32_t last_set_brightness;
+    XRRCrtcGamma **gamma_precalc;   /* Finished ramps, one per level */
+    float precalc_red, precalc_green, precalc_blue;
+    int precalc_size;               /* Curve the ramps were made from */
+    struct gamma_curve curve[3];    /* Red, green and blue power curves */
+    uint32_t last_set_brightness;   /* Owned by the apply thread */
+    uint32_t requested_level;       /* Latest gamma level asked for */
+    bool apply_pending;
+    uint32_t frame_time;            /* Refresh interval of the CRTC, in us */
+    uint64_t next_apply;            /* Earliest time for the next upload */
+    uint32_t requested_backlight;   /* Latest backlight level asked for */
+    bool backlight_pending;
+    uint32_t written_backlight;     /* Last backlight level written */
+    uint32_t backlight_latency;     /* Smoothed time a write takes, in us */
+    uint64_t next_backlight;        /* Earliest time for the next write */
+    uint64_t written_fingerprint;   /* Of the last ramp we uploaded */
+    uint64_t gamma_fingerprint;     /* Of the last ramp we read back */
+    bool gamma_loaded;              /* Ramp read back and estimated */
+    uint32_t poll_interval;         /* Current gamma polling interval, in us */
+    uint64_t next_poll;             /* Time of the next gamma poll */
+    bool gamma_poll_due;
     struct dimensions dim;          /* Monitor position and size */
     pthread_mutex_t mutex;
-    bool thread_active;
-    bool thread_kill;
 };
 
+static void estimate_gamma(struct monitor_data *m);
+
 /* Multiple outputs may share the same controller.
    Retain the unique names but share the rest of the data between clones. */
 struct monitor {
@@ -69,15 +105,54 @@ struct monitor {
     struct monitor_data *data;
 };
 
-static char *methods[] = { "None", "Backlight", "Gamma" };
+/* Levels 0..100 of the gamma method */
+#define GAMMA_LEVELS 101
+
+/* Used when the refresh rate of a CRTC is unknown, 60 Hz */
+#define DEFAULT_FRAME_TIME 16667
+
+/* Backlight writes are spaced by twice their smoothed latency, so the
+   server is never kept busy with them more than half of the time */
+#define BACKLIGHT_LATENCY_MAX 500000
+
+/* Gamma polling backs off from every tick to every few seconds */
+#define GAMMA_POLL_MIN 100000
+#define GAMMA_POLL_MAX 6400000
+
+/* Backlight properties are cheap to read, poll them ten times a second */
+#define BACKLIGHT_POLL 100000
+
+/* While ramps are left to read back, one is read every so often (ms) */
+#define GAMMA_LOAD_INTERVAL 100
+
+/* Longest wait for DDC/CI monitors to answer when setting a level once (ms) */
+#define DDC_ONESHOT_TIMEOUT 2000
+
+static char *methods[] = { "None", "Backlight", "Gamma", "Sysfs", "DDC" };
 static struct monitor *monitors;
 static int cur_monitor;
 static int n_monitors;
-static bool needs_update;
+static bool check_pending;
 static Display *display;
+static XRRScreenResources *screen_resources;
 static float global_offset;
 static bool verbose;
 const char **excluded_outputs;
+static pthread_t precalc_thread;
+static bool precalc_active;
+static bool precalc_kill;
+static pthread_mutex_t precalc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool precalc_running;        /* The thread has not finished yet */
+static bool precalc_again;          /* More ramps were read back meanwhile */
+static pthread_t apply_thread;
+static pthread_mutex_t apply_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t apply_cond;
+static bool apply_quit;
+static bool apply_flush;
+static int wake_fd = -1;
+static uint64_t next_backlight_poll;
+static const char *only_output;     /* Set up just this output, NULL = all */
+static bool oneshot;
 
 
 /* static int elem_callback(__attribute__((unused)) snd_mixer_elem_t *elem, */
@@ -98,55 +173,6 @@ const char **excluded_outputs;
 /*     return 0; */
 /* } */
 
-static bool get_backlight_property(struct monitor_data *m)
-{
-    int propcount;
-    Atom *a = XRRListOutputProperties(display, m->output, &propcount);
-    for (int j = 0; j < propcount; j++) {
-        char *name = XGetAtomName(display, a[j]);
-        bool found_backlight = !strcmp(name, "Backlight");
-        Xfree(name);
-        if (found_backlight) {
-            XRRPropertyInfo *pi = XRRQueryOutputProperty(display, m->output, a[j]);
-            if (pi->range != 1 || pi->num_values != 2) {
-                printf("Output has backlight support but its settings were not understood.");
-                Xfree(pi);
-                Xfree(a);
-                return false;
-            }
-            m->min[BACKLIGHT] = pi->values[0];
-            m->max[BACKLIGHT] = pi->values[1];
-            Xfree(pi);
-            unsigned char *prop;
-            Atom actual_type;
-            int actual_format;
-            unsigned long nitems, bytes_after;
-            XRRGetOutputProperty(display, m->output, a[j], 0, 100, False, False,
-                                 AnyPropertyType, &actual_type, &actual_format,
-                                 &nitems, &bytes_after, &prop);
-            if (verbose)
-                printf("Items: %d, value_type: %d, value_format: %d\n", (int)nitems, (int)actual_type, actual_format);
-            if (actual_type != XA_INTEGER) {
-                printf("Output has backlight support but it's type is strange: %d\n",
-                       (int)actual_type);
-            }
-            m->backlight_atom = a[j];
-            m->level[BACKLIGHT] = *(uint32_t *)prop;
-            Xfree(prop);
-            if (verbose)
-                printf("Output supports backlight, range: (%d, %d), current: %d\n",
-                       m->min[BACKLIGHT], m->max[BACKLIGHT], m->level[BACKLIGHT]);
-            m->supported_methods[BACKLIGHT] = true;
-            Xfree(a);
-            return true;
-        }
-    }
-    if (propcount > 0) {
-        Xfree(a);
-    }
-    return false;
-}
-
 static void get_backlight_level(struct monitor_data *m)
 {
     unsigned char *prop;
@@ -164,109 +190,377 @@ static void set_backlight_level(struct monitor_data *m)
     m->actual_level = CLAMP(m->normalised_level[BACKLIGHT] + global_offset, 0.0, 1.0);
     m->level[BACKLIGHT] = CLAMP(min + (max - min) * m->actual_level, min, max);
 
-    XRRChangeOutputProperty(display, m->output, m->backlight_atom, XA_INTEGER, 32,
-                            PropModeReplace, (unsigned char *)(&m->level[BACKLIGHT]), 1);
+    pthread_mutex_lock(&apply_mutex);
+    m->requested_backlight = m->level[BACKLIGHT];
+    m->backlight_pending = true;
+    pthread_cond_signal(&apply_cond);
+    pthread_mutex_unlock(&apply_mutex);
 }
 
-static void brightness_to_gamma(struct monitor_data *m)
+static void set_sysfs_level(struct monitor_data *m)
 {
-    int i, shift;
-    float gammaRed;
-    float gammaGreen;
-    float gammaBlue;
-    float brightness = m->last_set_brightness / 100.0;
+    uint32_t max = m->max[SYSFS];
+    m->actual_level = CLAMP(m->normalised_level[SYSFS] + global_offset, 0.0, 1.0);
+    m->level[SYSFS] = CLAMP(max * m->actual_level + 0.5, 0, max);
+
+    sysfs_set_level(m->sysfs, m->level[SYSFS]);
+}
+
+static void set_ddc_level(struct monitor_data *m)
+{
+    uint32_t max = m->max[DDC];
+    m->actual_level = CLAMP(m->normalised_level[DDC] + global_offset, 0.0, 1.0);
+    m->level[DDC] = CLAMP(max * m->actual_level + 0.5, 0, max);
+
+    ddc_set_level(m->ddc, m->level[DDC]);
+}
 
-    if (!m->gamma) {
+static void brightness_to_gamma(struct monitor_data *m, XRRCrtcGamma *gamma, uint32_t level)
+{
+    if (!gamma) {
         fprintf(stderr, "wmbright:error: Gamma struct was not allocated!\n");
         return;
     }
 
-    /*
-     * The hardware color lookup table has a number of significant
-     * bits equal to ffs(size) - 1; compute all values so that
-     * they are in the range [0,size) then shift the values so
-     * that they occupy the MSBs of the 16-bit X Color.
-     */
-    shift = 16 - (ffs(m->gamma_size) - 1);
-
-    if (m->gamma_red == 0.0)
-        m->gamma_red = 1.0;
-    if (m->gamma_green == 0.0)
-        m->gamma_green = 1.0;
-    if (m->gamma_blue == 0.0)
-        m->gamma_blue = 1.0;
-
-    gammaRed = 1.0 / m->gamma_red;
-    gammaGreen = 1.0 / m->gamma_green;
-    gammaBlue = 1.0 / m->gamma_blue;
-    
-    for (i = 0; i < m->gamma_size; i++) {
-        if (gammaRed == 1.0 && brightness == 1.0)
-            m->gamma->red[i] = i;
-        else
-            m->gamma->red[i] = fmin(pow((double)i/(double)(m->gamma_size - 1),
-                                     gammaRed) * brightness,
-                                 1.0) * (double)(m->gamma_size - 1);
-        m->gamma->red[i] <<= shift;
-        
-        if (gammaGreen == 1.0 && brightness == 1.0)
-            m->gamma->green[i] = i;
-        else
-            m->gamma->green[i] = fmin(pow((double)i/(double)(m->gamma_size - 1),
-                                       gammaGreen) * brightness,
-                                   1.0) * (double)(m->gamma_size - 1);
-        m->gamma->green[i] <<= shift;
-        
-        if (gammaBlue == 1.0 && brightness == 1.0)
-            m->gamma->blue[i] = i;
-        else
-            m->gamma->blue[i] = fmin(pow((double)i/(double)(m->gamma_size - 1),
-                                      gammaBlue) * brightness,
-                                  1.0) * (double)(m->gamma_size - 1);
-        m->gamma->blue[i] <<= shift;
+    gamma_ramp_fill(&m->curve[0], level, gamma->red);
+    gamma_ramp_fill(&m->curve[1], level, gamma->green);
+    gamma_ramp_fill(&m->curve[2], level, gamma->blue);
+}
+
+/* True if the precalculated ramps were made from the current gamma curve */
+static bool gamma_precalc_is_current(struct monitor_data *m)
+{
+    return m->gamma_precalc
+        && m->precalc_size == m->gamma_size
+        && m->precalc_red == m->gamma_red
+        && m->precalc_green == m->gamma_green
+        && m->precalc_blue == m->gamma_blue;
+}
+
+/* Free all precalculated ramps. Caller must hold m->mutex. */
+static void gamma_precalc_drop(struct monitor_data *m)
+{
+    if (!m->gamma_precalc)
+        return;
+    for (int i = 0; i < GAMMA_LEVELS; i++) {
+        if (m->gamma_precalc[i])
+            XRRFreeGamma(m->gamma_precalc[i]);
+    }
+    for (int i = 0; i < 3; i++)
+        gamma_curve_free(&m->curve[i]);
+    free(m->gamma_precalc);
+    m->gamma_precalc = NULL;
+}
+
+/* Look up the ramp for a level, calculating it if it's not cached yet.
+   Caller must hold m->mutex. */
+static XRRCrtcGamma *gamma_precalc_get(struct monitor_data *m, uint32_t level)
+{
+    if (!gamma_precalc_is_current(m)) {
+        gamma_precalc_drop(m);
+        m->gamma_precalc = (XRRCrtcGamma **)calloc(GAMMA_LEVELS, sizeof(XRRCrtcGamma *));
+        if (!m->gamma_precalc)
+            return NULL;
+        m->precalc_size = m->gamma_size;
+        m->precalc_red = m->gamma_red;
+        m->precalc_green = m->gamma_green;
+        m->precalc_blue = m->gamma_blue;
+        if (!gamma_curve_init(&m->curve[0], m->gamma_size, m->gamma_red)
+            || !gamma_curve_init(&m->curve[1], m->gamma_size, m->gamma_green)
+            || !gamma_curve_init(&m->curve[2], m->gamma_size, m->gamma_blue)) {
+            gamma_precalc_drop(m);
+            return NULL;
+        }
+    }
+    if (!m->gamma_precalc[level]) {
+        XRRCrtcGamma *gamma = XRRAllocGamma(m->gamma_size);
+        if (!gamma)
+            return NULL;
+        brightness_to_gamma(m, gamma, level);
+        m->gamma_precalc[level] = gamma;
     }
+    return m->gamma_precalc[level];
 }
 
-static void *do_set_brightness_level(void *data)
+/* Fill the ramp caches of all gamma capable monitors in the background */
+static void *do_gamma_precalc(__attribute__((unused)) void *data)
 {
-    struct monitor_data *m = (struct monitor_data *)data;
+    bool again;
+
     do {
-        uint32_t min = m->min[GAMMA], max = m->max[GAMMA];
-        m->actual_level = CLAMP(m->normalised_level[GAMMA] + global_offset, 0.0, 1.0);
-        m->level[GAMMA] = CLAMP((max-min) * m->actual_level, min, max);
+        pthread_mutex_lock(&precalc_mutex);
+        precalc_again = false;
+        pthread_mutex_unlock(&precalc_mutex);
 
-        pthread_mutex_lock(&m->mutex);
-        if (m->thread_kill || m->last_set_brightness == m->level[GAMMA]) {
-            m->thread_active = false;
+        for (int i = 1; i < n_monitors; i++) {
+            struct monitor_data *m = monitors[i].data;
+            if (monitors[i].is_clone || !m->supported_methods[GAMMA])
+                continue;
+            for (uint32_t level = 0; level < GAMMA_LEVELS; level++) {
+                pthread_mutex_lock(&m->mutex);
+                if (precalc_kill) {
+                    pthread_mutex_unlock(&m->mutex);
+                    pthread_mutex_lock(&precalc_mutex);
+                    precalc_running = false;
+                    pthread_mutex_unlock(&precalc_mutex);
+                    return NULL;
+                }
+                if (!m->gamma_loaded) {
+                    pthread_mutex_unlock(&m->mutex);
+                    break;
+                }
+                gamma_precalc_get(m, level);
+                pthread_mutex_unlock(&m->mutex);
+            }
+        }
+
+        /* Go over the monitors again if one was read back meanwhile */
+        pthread_mutex_lock(&precalc_mutex);
+        again = precalc_again;
+        if (!again)
+            precalc_running = false;
+        pthread_mutex_unlock(&precalc_mutex);
+    } while (again);
+
+    if (verbose)
+        printf("Gamma ramps precalculated\n");
+    return NULL;
+}
+
+static void gamma_precalc_stop(void)
+{
+    if (!precalc_active)
+        return;
+    precalc_kill = true;
+    pthread_join(precalc_thread, NULL);
+    precalc_active = false;
+}
+
+static void gamma_precalc_start(void)
+{
+    gamma_precalc_stop();
+    precalc_kill = false;
+    precalc_running = true;
+    if (pthread_create(&precalc_thread, NULL, do_gamma_precalc, NULL) == 0)
+        precalc_active = true;
+    else
+        precalc_running = false;
+}
+
+/* Have the ramps of a monitor that was just read back precalculated,
+   without waiting for the thread if it is still going */
+static void gamma_precalc_queue(void)
+{
+    pthread_mutex_lock(&precalc_mutex);
+    if (precalc_running) {
+        precalc_again = true;
+        pthread_mutex_unlock(&precalc_mutex);
+        return;
+    }
+    pthread_mutex_unlock(&precalc_mutex);
+    /* The thread is done, if there is one, so joining it is quick */
+    gamma_precalc_start();
+}
+
+static uint64_t monotonic_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Time between two refreshes of a mode, in microseconds */
+static uint32_t get_frame_time(XRRScreenResources *screen, RRMode mode)
+{
+    for (int i = 0; i < screen->nmode; i++) {
+        XRRModeInfo *mi = &screen->modes[i];
+        if (mi->id != mode)
+            continue;
+        double vtotal = mi->vTotal;
+        if (mi->modeFlags & RR_DoubleScan)
+            vtotal *= 2;
+        if (mi->modeFlags & RR_Interlace)
+            vtotal /= 2;
+        if (mi->dotClock == 0 || mi->hTotal == 0 || vtotal == 0)
+            break;
+        return 1000000.0 * mi->hTotal * vtotal / mi->dotClock;
+    }
+    return DEFAULT_FRAME_TIME;
+}
+
+/* Shortest time between two ramp uploads to a CRTC */
+static uint32_t get_apply_interval(struct monitor_data *m)
+{
+    uint32_t interval = m->frame_time;
+    if (config.gamma_rate > 0 && interval < 1000000 / config.gamma_rate)
+        interval = 1000000 / config.gamma_rate;
+    return interval;
+}
+
+/* Write a backlight level and wait for the server to be done with it.
+   Returns how long that took, in us. Goes through XCB so that the
+   main thread can keep using the display meanwhile. */
+static uint32_t write_backlight_level(struct monitor_data *m, uint32_t level)
+{
+    xcb_connection_t *c = XGetXCBConnection(display);
+    uint64_t start = monotonic_usec();
+
+    xcb_randr_change_output_property(c, m->output, m->backlight_atom, XCB_ATOM_INTEGER,
+                                     32, XCB_PROP_MODE_REPLACE, 1, &level);
+    free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), NULL));
+    return monotonic_usec() - start;
+}
+
+/* Talking to the server here can leave events in the queues of Xlib and
+   XCB, where the main loop would not notice them while it sleeps */
+static void wake_main_loop(void)
+{
+    uint64_t one = 1;
+
+    if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0) {
+        /* Only fails if the counter is about to overflow, still readable then */
+    }
+}
+
+/* The apply thread: upload the latest requested ramp of every CRTC, at
+   most once per refresh, and write the latest requested backlight level
+   of every output as often as the server keeps up with. Requests made in
+   between are coalesced. When told to flush, whatever is still pending is
+   applied right away before quitting, so that the last request lands. */
+static void *do_set_brightness_level(__attribute__((unused)) void *data)
+{
+    pthread_mutex_lock(&apply_mutex);
+    while (!apply_quit || apply_flush) {
+        uint64_t now = monotonic_usec();
+        uint64_t next = 0;
+        bool flush = apply_flush;
+        bool applied = false;
+        bool written = false;
+
+        for (int i = 1; i < n_monitors; i++) {
+            struct monitor_data *m = monitors[i].data;
+            if (monitors[i].is_clone)
+                continue;
+            if (m->backlight_pending) {
+                if (m->next_backlight > now && !flush) {
+                    if (next == 0 || m->next_backlight < next)
+                        next = m->next_backlight;
+                } else {
+                    uint32_t level = m->requested_backlight;
+                    m->backlight_pending = false;
+                    m->written_backlight = level;
+                    pthread_mutex_unlock(&apply_mutex);
+
+                    uint32_t latency = write_backlight_level(m, level);
+                    m->backlight_latency = MIN((3 * m->backlight_latency + latency) / 4,
+                                               BACKLIGHT_LATENCY_MAX);
+                    m->next_backlight = now + MAX(2 * m->backlight_latency, m->frame_time);
+                    written = true;
+
+                    pthread_mutex_lock(&apply_mutex);
+                    /* A new level may have come in during the write */
+                    if (m->backlight_pending && (next == 0 || m->next_backlight < next))
+                        next = m->next_backlight;
+                }
+            }
+            if (!m->apply_pending)
+                continue;
+            if (m->next_apply > now && !flush) {
+                if (next == 0 || m->next_apply < next)
+                    next = m->next_apply;
+                continue;
+            }
+            uint32_t level = m->requested_level;
+            m->apply_pending = false;
+            if (level == m->last_set_brightness)
+                continue;
+            pthread_mutex_unlock(&apply_mutex);
+
+            pthread_mutex_lock(&m->mutex);
+            XRRCrtcGamma *gamma = gamma_precalc_get(m, level);
+            if (gamma) {
+                XRRSetCrtcGamma(display, m->crtc, gamma);
+                m->written_fingerprint = gamma_ramp_fingerprint(gamma->red, gamma->green,
+                                                                gamma->blue, gamma->size);
+            }
             pthread_mutex_unlock(&m->mutex);
-            return NULL;
+            m->last_set_brightness = level;
+            m->next_apply = now + get_apply_interval(m);
+            applied = true;
+
+            pthread_mutex_lock(&apply_mutex);
         }
-        pthread_mutex_unlock(&m->mutex);
+        if (applied) {
+            pthread_mutex_unlock(&apply_mutex);
+            XFlush(display);
+            pthread_mutex_lock(&apply_mutex);
+        }
+        if (written || applied)
+            wake_main_loop();
+        if (flush)
+            break;
+        /* The lock was let go of meanwhile, so a request and its signal
+           may have gone by without anyone waiting; look again */
+        if (applied || written)
+            continue;
 
-        m->last_set_brightness = m->level[GAMMA];
-        brightness_to_gamma(m);
-        XRRSetCrtcGamma(display, m->crtc, m->gamma);
-        XFlush(display);
-        usleep(100000);
-    } while (true);
+        if (next == 0) {
+            pthread_cond_wait(&apply_cond, &apply_mutex);
+        } else {
+            struct timespec ts = { next / 1000000, (next % 1000000) * 1000 };
+            pthread_cond_timedwait(&apply_cond, &apply_mutex, &ts);
+        }
+    }
+    pthread_mutex_unlock(&apply_mutex);
+    return NULL;
 }
 
 static void set_brightness_level(struct monitor_data *m)
 {
-    pthread_t thread;
     uint32_t min = m->min[GAMMA], max = m->max[GAMMA];
 
-    pthread_mutex_lock(&m->mutex);
     m->actual_level = CLAMP(m->normalised_level[GAMMA] + global_offset, 0.0, 1.0);
-
     m->level[GAMMA] = CLAMP((max - min) * m->actual_level, min, max);
-    if (m->thread_active || (m->last_set_brightness == m->level[GAMMA])) {
-        pthread_mutex_unlock(&m->mutex);
-        return;
-    }
-    m->thread_active = true;
-    pthread_mutex_unlock(&m->mutex);
-    pthread_create(&thread, NULL, do_set_brightness_level, (void *)m);
+
+    /* Someone may be fighting over the gamma, look again soon */
+    m->poll_interval = GAMMA_POLL_MIN;
+    m->next_poll = monotonic_usec() + GAMMA_POLL_MIN;
+
+    pthread_mutex_lock(&apply_mutex);
+    m->requested_level = m->level[GAMMA];
+    m->apply_pending = true;
+    pthread_cond_signal(&apply_cond);
+    pthread_mutex_unlock(&apply_mutex);
+}
+
+static void apply_thread_start(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&apply_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    apply_quit = false;
+    apply_flush = false;
+    if (pthread_create(&apply_thread, NULL, do_set_brightness_level, NULL) != 0)
+        fprintf(stderr, "wmbright:error: Could not start the gamma thread\n");
+}
+
+/* Stop the apply thread. Unless flushing, requests that were not yet
+   applied stay in their slots and are picked up when the thread is
+   started again. */
+static void apply_thread_stop(bool flush)
+{
+    pthread_mutex_lock(&apply_mutex);
+    apply_quit = true;
+    apply_flush = flush;
+    pthread_cond_signal(&apply_cond);
+    pthread_mutex_unlock(&apply_mutex);
+    pthread_join(apply_thread, NULL);
+    pthread_cond_destroy(&apply_cond);
 }
 
 /* Returns the index of the last value in an array < 0xffff */
@@ -280,39 +574,44 @@ static int find_last_non_clamped(CARD16 array[], int size)
     return 0;
 }
 
-/* Allocate the gamma struct and leave it for later */
-static bool get_gamma_property(struct monitor_data *m)
+/* Reallocate the gamma struct and calculate brightness from it */
+/* Unless forced, a ramp that we have already seen or that we wrote
+   ourselves is not estimated again. Returns true if it was estimated. */
+static bool get_gamma_values(struct monitor_data *m, bool force)
 {
-    m->gamma_size = XRRGetCrtcGammaSize(display, m->crtc);
-    if (verbose)
-        printf("Gamma size: %d\n", m->gamma_size);
-    if (!m->gamma_size) {
-        fprintf(stderr, "wmbright:warning: Failed to get size of gamma for output %ld\n", m->output);
+    XRRCrtcGamma *gamma = XRRGetCrtcGamma(display, m->crtc);
+    if (!gamma) {
+        fprintf(stderr, "wmbright:warning: Failed to get gamma for output %ld\n", m->output);
         return false;
     }
-
-    m->gamma = XRRGetCrtcGamma(display, m->crtc);
-    if (!m->gamma) {
-        fprintf(stderr, "wmbright:warning: Failed to get gamma for output %ld\n", m->output);
+    uint64_t fingerprint = gamma_ramp_fingerprint(gamma->red, gamma->green,
+                                                  gamma->blue, gamma->size);
+    pthread_mutex_lock(&m->mutex);
+    uint64_t written = m->written_fingerprint;
+    pthread_mutex_unlock(&m->mutex);
+    if (!force && (fingerprint == m->gamma_fingerprint || fingerprint == written)) {
+        m->gamma_fingerprint = fingerprint;
+        XRRFreeGamma(gamma);
         return false;
     }
-    m->min[GAMMA] = 0;
-    m->max[GAMMA] = 100;
-    m->supported_methods[GAMMA] = true;
+    if (gamma->size != m->gamma_size) {
+        /* Only happens if the cache was wrong, don't trust it again */
+        pthread_mutex_lock(&m->mutex);
+        m->gamma_size = gamma->size;
+        pthread_mutex_unlock(&m->mutex);
+        cache_forget(m->edid_hash);
+        cache_save();
+    }
+    XRRFreeGamma(m->gamma);
+    m->gamma = gamma;
+    m->gamma_fingerprint = fingerprint;
+    estimate_gamma(m);
     return true;
 }
 
-/* Reallocate the gamma struct and calculate brightness from it */
-/* Assumes that gamma_size has not changed, which would be really weird */
-static void get_gamma_values(struct monitor_data *m)
+/* Calculate brightness and gamma of each channel from the current ramp */
+static void estimate_gamma(struct monitor_data *m)
 {
-    XRRFreeGamma(m->gamma);
-    m->gamma = XRRGetCrtcGamma(display, m->crtc);
-    if (!m->gamma) {
-        fprintf(stderr, "wmbright:warning: Failed to get gamma for output %ld\n", m->output);
-        return;
-    }
-
     double i1, v1, i2, v2;
     int middle, last_best, last_red, last_green, last_blue;
     CARD16 *best_array;
@@ -353,6 +652,7 @@ static void get_gamma_values(struct monitor_data *m)
     v1 = (double)(best_array[middle]) / 65535;
     i2 = (double)(last_best + 1) / m->gamma_size;
     v2 = (double)(best_array[last_best]) / 65535;
+    pthread_mutex_lock(&m->mutex);
     if (v2 < 0.0001) { /* The screen is black */
         brightness = 0;
         m->gamma_red = 1;
@@ -372,10 +672,82 @@ static void get_gamma_values(struct monitor_data *m)
         if (verbose)
             printf("red: %f, green: %f, blue: %f, brightness: %f\n", m->gamma_red, m->gamma_green, m->gamma_blue, brightness);
     }
+    /* The curve changed under us, the cached ramps are useless now */
+    if (m->gamma_precalc && !gamma_precalc_is_current(m))
+        gamma_precalc_drop(m);
+    m->gamma_loaded = true;
+    pthread_mutex_unlock(&m->mutex);
     
     m->level[GAMMA] = (100 * brightness) + 0.5;
 }
 
+/* Read back the ramp of a monitor if that hasn't been done yet.
+   Returns true if its level changed. */
+static bool gamma_load(struct monitor_data *m)
+{
+    if (!m->supported_methods[GAMMA] || m->gamma_loaded)
+        return false;
+    if (!get_gamma_values(m, true)) {
+        /* Nothing to estimate from, don't try again */
+        m->supported_methods[GAMMA] = false;
+        if (m->current_method == GAMMA)
+            m->current_method = method_pick(m->supported_methods, m->preferred_method);
+        m->actual_level = m->normalised_level[m->current_method];
+        return true;
+    }
+    m->normalised_level[GAMMA] = (float)m->level[GAMMA] / m->max[GAMMA];
+    m->actual_level = m->normalised_level[m->current_method];
+    m->next_poll = monotonic_usec() + m->poll_interval;
+    /* A single level is calculated faster than all of them */
+    if (!oneshot)
+        gamma_precalc_queue();
+    return true;
+}
+
+/* Read back the ramps of the selected monitor, or all of them */
+static void gamma_load_selected(void)
+{
+    for (int i = 1; i < n_monitors; i++) {
+        if (!monitors[i].is_clone && (cur_monitor == 0 || cur_monitor == i))
+            gamma_load(monitors[i].data);
+    }
+}
+
+/* Read back one ramp that nobody asked for yet. Returns true if a
+   level changed. */
+static bool gamma_load_next(void)
+{
+    for (int i = 1; i < n_monitors; i++) {
+        struct monitor_data *m = monitors[i].data;
+        if (!monitors[i].is_clone && m->supported_methods[GAMMA] && !m->gamma_loaded)
+            return gamma_load(m);
+    }
+    return false;
+}
+
+/*
+ * The screen resources, shared by everyone
+ *
+ * XRRGetScreenResources makes some drivers probe all outputs, which can
+ * take a long time. The current configuration is all we need, and that
+ * only changes when the server tells us so.
+ */
+XRRScreenResources *brightness_get_screen(void)
+{
+    if (!screen_resources)
+        screen_resources = XRRGetScreenResourcesCurrent(display, DefaultRootWindow(display));
+    return screen_resources;
+}
+
+/* Drop the screen resources, to be called on RandR notifications */
+void brightness_screen_changed(void)
+{
+    if (screen_resources) {
+        XRRFreeScreenResources(screen_resources);
+        screen_resources = NULL;
+    }
+}
+
 static bool is_excluded(const char *short_name, const char *exclude[])
 {
     for (int i = 0; exclude[i] != NULL; i++) {
@@ -386,21 +758,152 @@ static bool is_excluded(const char *short_name, const char *exclude[])
     return false;
 }
 
+/* Whether an output is to be controlled at all */
+static bool is_wanted(const char *short_name)
+{
+    if (only_output)
+        return !strcmp(short_name, only_output);
+    return !is_excluded(short_name, excluded_outputs);
+}
 
-void brightness_init(Display *x_display, bool set_verbose, const char *exclude[])
+
+/* Normalise the levels of a monitor into [0, 1] */
+static void normalise_levels(struct monitor_data *m)
 {
-    excluded_outputs = exclude;
-    needs_update = true;
-    display = x_display;
-    verbose = set_verbose;
-    XRRScreenResources *screen = XRRGetScreenResources(display, DefaultRootWindow(display));
+    for (int method = BACKLIGHT; method <= DDC; method++) {
+        if (m->supported_methods[method]) {
+            uint32_t min = m->min[method], max = m->max[method];
+            m->normalised_level[method] = (float)(m->level[method] - min) / (max - min);
+        }
+    }
+    m->actual_level = m->normalised_level[m->current_method];
+}
+
+/* Position, size and refresh rate of the CRTC of a monitor */
+static void set_crtc_info(struct monitor_data *d, XRRScreenResources *screen,
+                          struct output_probe *p)
+{
+    d->dim = p->dim;
+    d->frame_time = get_frame_time(screen, p->mode);
+    if (verbose)
+        printf("Refresh interval: %u us\n", d->frame_time);
+}
+
+/* Set up a monitor that we haven't seen before from its probe */
+static struct monitor_data *new_monitor_data(XRRScreenResources *screen, struct output_probe *p)
+{
+    struct monitor_data *d = (struct monitor_data *)malloc(sizeof(struct monitor_data));
+    d->supported_methods[0] = true;
+    d->supported_methods[1] = false;
+    d->supported_methods[2] = false;
+    d->supported_methods[3] = false;
+    d->supported_methods[4] = false;
+    d->ddc = NULL;
+    d->preferred_method = NONE;
+    d->current_method = NONE;
+    d->backlight_changed = false;
+    d->crtc = p->crtc;
+    d->output = p->output;
+    d->edid_hash = p->edid_hash;
+    pthread_mutex_init(&d->mutex, NULL);
+    d->last_set_brightness = GAMMA_LEVELS;
+    d->apply_pending = false;
+    d->next_apply = 0;
+    d->backlight_pending = false;
+    d->written_backlight = p->backlight_level;
+    d->backlight_latency = 0;
+    d->next_backlight = 0;
+    d->written_fingerprint = 0;
+    d->gamma_fingerprint = 0;
+    d->poll_interval = GAMMA_POLL_MIN;
+    d->next_poll = 0;
+    d->gamma_poll_due = false;
+    d->gamma = NULL;
+    d->gamma_loaded = false;
+    d->gamma_precalc = NULL;
+    for (int c = 0; c < 3; c++)
+        d->curve[c].values = NULL;
+
+    if (p->has_backlight) {
+        d->backlight_atom = p->backlight_atom;
+        d->min[BACKLIGHT] = p->backlight_min;
+        d->max[BACKLIGHT] = p->backlight_max;
+        d->level[BACKLIGHT] = p->backlight_level;
+        if (verbose)
+            printf("Output supports backlight, range: (%d, %d), current: %d\n",
+                   d->min[BACKLIGHT], d->max[BACKLIGHT], d->level[BACKLIGHT]);
+        d->supported_methods[BACKLIGHT] = true;
+    }
+
+    d->sysfs = sysfs_find(p->name);
+    if (d->sysfs && sysfs_get_level(d->sysfs, &d->level[SYSFS])) {
+        d->min[SYSFS] = 0;
+        d->max[SYSFS] = sysfs_get_max(d->sysfs);
+        if (verbose)
+            printf("Output has a kernel backlight, range: (0, %d), current: %d\n",
+                   d->max[SYSFS], d->level[SYSFS]);
+        d->supported_methods[SYSFS] = true;
+    }
+
+    d->gamma_size = p->gamma_size;
+    if (verbose)
+        printf("Gamma size: %d\n", d->gamma_size);
+    if (!d->gamma_size) {
+        fprintf(stderr, "wmbright:warning: Failed to get size of gamma for output %ld\n", d->output);
+    } else {
+        /* The ramp itself is read when the output is first used, until
+           then assume that it is untouched */
+        d->min[GAMMA] = 0;
+        d->max[GAMMA] = 100;
+        d->level[GAMMA] = 100;
+        d->gamma_red = d->gamma_green = d->gamma_blue = 1;
+        d->supported_methods[GAMMA] = true;
+    }
+
+    if (p->cached) {
+        if (verbose)
+            printf("Capabilities were cached\n");
+        if (p->method > NONE && p->method <= DDC)
+            d->preferred_method = p->method;
+    } else {
+        struct output_caps caps = { d->edid_hash, p->backlight_min, p->backlight_max,
+                                    p->gamma_size, p->has_backlight, NONE, { 0 } };
+        cache_store(&caps);
+    }
+    d->current_method = method_pick(d->supported_methods, d->preferred_method);
+
+    set_crtc_info(d, screen, p);
+    normalise_levels(d);
+    return d;
+}
+
+static void free_monitor_data(struct monitor_data *m)
+{
+    pthread_mutex_lock(&m->mutex);
+    gamma_precalc_drop(m);
+    pthread_mutex_unlock(&m->mutex);
+    pthread_mutex_destroy(&m->mutex);
+    XRRFreeGamma(m->gamma);
+    free(m);
+}
+
+/*
+ * Build the list of monitors from the outputs in use
+ *
+ * Monitors found in the old list on the same output and controller keep
+ * their data, only new or changed outputs are probed. The data that was
+ * taken over is removed from the old list.
+ */
+static void build_monitors(XRRScreenResources *screen, struct monitor *old, int n_old)
+{
+    struct output_probe *probes = probe_outputs(display, screen);
+    int probe_index[screen->noutput + 1];
+    int clone_of[screen->noutput + 1];
 
     /* Count the number of monitors that are actually in use. */
     n_monitors = 1;
-    XRROutputInfo *oi[screen->noutput];
     for (int i = 0; i < screen->noutput; i++) {
-        oi[i] = XRRGetOutputInfo(display, screen, screen->outputs[i]);
-        if (oi[i]->crtc != 0 && !is_excluded(oi[i]->name, excluded_outputs))
+        if (probes[i].crtc != 0 && is_wanted(probes[i].name))
             n_monitors++;
     }
 
@@ -409,103 +912,208 @@ void brightness_init(Display *x_display, bool set_verbose, const char *exclude[]
     monitors = (struct monitor *)malloc((n_monitors + 1) * sizeof(struct monitor));
 
     /* Use the first entry for the global controller */
-    cur_monitor = 0;
-    monitors[0].name[0] = 'A';
-    monitors[0].name[1] = 'L';
-    monitors[0].name[2] = 'L';
-    monitors[0].name[3] = '\0';
-    monitors[0].data = (struct monitor_data *)malloc(sizeof(struct monitor_data));
-    monitors[0].data->normalised_level[NONE] = 0.5;
-    monitors[0].data->actual_level = 0.5;
-    monitors[0].data->supported_methods[0] = true;
-    monitors[0].data->supported_methods[1] = false;
-    monitors[0].data->supported_methods[2] = false;
-    global_offset = 0.0;
+    if (old) {
+        monitors[0] = old[0];
+        old[0].data = NULL;
+    } else {
+        monitors[0].name[0] = 'A';
+        monitors[0].name[1] = 'L';
+        monitors[0].name[2] = 'L';
+        monitors[0].name[3] = '\0';
+        monitors[0].is_clone = false;
+        monitors[0].data = (struct monitor_data *)malloc(sizeof(struct monitor_data));
+        monitors[0].data->normalised_level[NONE] = 0.5;
+        monitors[0].data->actual_level = 0.5;
+        monitors[0].data->supported_methods[0] = true;
+        monitors[0].data->supported_methods[1] = false;
+        monitors[0].data->supported_methods[2] = false;
+        monitors[0].data->supported_methods[3] = false;
+        monitors[0].data->supported_methods[4] = false;
+        global_offset = 0.0;
+    }
 
+    /* First decide which outputs need probing... */
     int i2 = 0;
     for (int i = 0; i < screen->noutput; i++) {
+        struct output_probe *p = &probes[i];
         if (verbose)
-            printf("Found monitor: %s, connection: %d, output: %d crtc: %d\n", oi[i]->name, oi[i]->connection, (int)screen->outputs[i], (int)oi[i]->crtc);
-        if (oi[i]->crtc == 0 || is_excluded(oi[i]->name, excluded_outputs)) {
-            XRRFreeOutputInfo(oi[i]);
+            printf("Found monitor: %s, connection: %d, output: %d crtc: %d\n", p->name, p->connection, (int)p->output, (int)p->crtc);
+        if (p->crtc == 0 || !is_wanted(p->name))
             continue;
-        }
         i2++;
         struct monitor *m = monitors + i2;
-        strncpy(m->name, oi[i]->name, 16);
-        m->name[16] = '\0';
+        strcpy(m->name, p->name);
         m->is_clone = false;
-        for (int j = 0; j < oi[i]->nclone; j++) {
-            for (int k = 0; k < i2; k++) {
-                if (oi[i]->clones[j] == monitors[k].data->output) {
+        m->data = NULL;
+        probe_index[i2] = i;
+        for (int j = 0; j < p->nclone && !m->is_clone; j++) {
+            for (int k = 1; k < i2; k++) {
+                if (p->clones[j] == probes[probe_index[k]].output) {
                     if (verbose)
                         printf("This is a clone of %s\n", monitors[k].name);
-                    m->data = monitors[k].data;
+                    clone_of[i2] = monitors[k].is_clone ? clone_of[k] : k;
                     m->is_clone = true;
                     break;
                 }
             }
-            if (m->is_clone)
-                break;
         }
-        if (!m->is_clone) {
-            m->data = (struct monitor_data *)malloc(sizeof(struct monitor_data));
-            struct monitor_data *d = m->data;
-            d->supported_methods[0] = true;
-            d->supported_methods[1] = false;
-            d->supported_methods[2] = false;
-            d->current_method = NONE;
-            d->crtc = oi[i]->crtc;
-            d->output = screen->outputs[i];
-            pthread_mutex_init(&d->mutex, NULL);
-            d->thread_active = false;
-            d->thread_kill = false;
-            if (get_backlight_property(d))
-                d->current_method = BACKLIGHT;
-            if (get_gamma_property(d) && (d->current_method == NONE))
-                d->current_method = GAMMA;
-
-            XRRCrtcInfo *ci = XRRGetCrtcInfo(display, screen, d->crtc);
-            d->dim = (struct dimensions){ ci->x, ci->y, ci->width, ci->height };
-            XRRFreeCrtcInfo(ci);
+        if (m->is_clone)
+            continue;
+        p->wanted = PROBE_ALL;
+        for (int k = 1; k < n_old; k++) {
+            struct monitor_data *d = old[k].data;
+            if (!old[k].is_clone && d && d->output == p->output
+                && d->crtc == p->crtc && !strcmp(old[k].name, m->name)) {
+                if (verbose)
+                    printf("Output is unchanged\n");
+                p->wanted = PROBE_CRTC;
+                m->data = d;
+                old[k].data = NULL;
+                break;
+            }
         }
-        XRRFreeOutputInfo(oi[i]);
+    }
+
+    /* ...then probe them all at once and set them up */
+    probe_details(display, screen, probes, screen->noutput);
+    for (i2 = 1; i2 < n_monitors; i2++) {
+        struct monitor *m = monitors + i2;
+        struct output_probe *p = &probes[probe_index[i2]];
+        if (m->is_clone)
+            m->data = monitors[clone_of[i2]].data;
+        else if (m->data)
+            set_crtc_info(m->data, screen, p);
+        else
+            m->data = new_monitor_data(screen, p);
         if (verbose)
             printf("Stored monitor: %d, crtc: %ld\n", i2, m->data->crtc);
     }
-    
-    XRRFreeScreenResources(screen);
+    probe_free(probes, screen->noutput);
+}
 
-    get_brightness_state();
+void brightness_init(Display *x_display, bool set_verbose, const char *exclude[])
+{
+    excluded_outputs = exclude;
+    display = x_display;
+    verbose = set_verbose;
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    cur_monitor = 0;
+    cache_load(verbose);
+    sysfs_init(config.sysfs_root, verbose);
+    if (config.ddc)
+        ddc_init(config.ddc_root, config.poll, verbose);
+    build_monitors(brightness_get_screen(), NULL, 0);
+    cache_save();
+
+    apply_thread_start();
 }
 
-void brightness_reinit() {
-    // Wait for threads to finish, free everything and start over
-    for (int i = 0; i < n_monitors; i++) {
-        if (i > 0) {
-            struct monitor_data *m = monitors[i].data;
-            m->thread_kill = true;
-            while (m->thread_active) {
-                usleep(10000);
-            }
-            pthread_mutex_lock(&m->mutex);
-            pthread_mutex_unlock(&m->mutex);
-            pthread_mutex_destroy(&m->mutex);
-            XRRFreeGamma(monitors[i].data->gamma);
+/* Whether a monitor would rather be controlled through DDC/CI than how
+   it can be controlled now */
+static bool waiting_for_ddc(enum method method)
+{
+    for (int i = 1; i < n_monitors; i++) {
+        struct monitor_data *m = monitors[i].data;
+        if (monitors[i].is_clone || m->crtc == 0 || m->ddc)
+            continue;
+        if (method == DDC)
+            return true;
+        if (method == NONE && (m->current_method == GAMMA || m->current_method == NONE)
+            && (m->preferred_method == NONE || m->preferred_method == DDC))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Set up for changing a level once and exiting
+ *
+ * Only the named output is probed, or all of them if NULL, and nothing
+ * is polled or calculated ahead. Probing DDC/CI takes a while, so it is
+ * only waited for when asked for or when gamma is all there is otherwise.
+ * Returns false if there is no such output.
+ */
+bool brightness_init_oneshot(Display *x_display, bool set_verbose, const char *exclude[],
+                             const char *output, enum method method)
+{
+    excluded_outputs = exclude;
+    display = x_display;
+    verbose = set_verbose;
+    only_output = output;
+    oneshot = true;
+
+    cur_monitor = 0;
+    cache_load(verbose);
+    sysfs_init(config.sysfs_root, verbose);
+    build_monitors(brightness_get_screen(), NULL, 0);
+    if (n_monitors < 2)
+        return false;
+    if (output)
+        cur_monitor = 1;
+
+    if (config.ddc && waiting_for_ddc(method)) {
+        uint64_t deadline = monotonic_usec() + DDC_ONESHOT_TIMEOUT * 1000;
+        struct pollfd pfd;
+
+        ddc_init(config.ddc_root, false, verbose);
+        pfd.fd = ddc_get_fd();
+        pfd.events = POLLIN;
+        while (pfd.fd >= 0 && waiting_for_ddc(method) && ddc_is_probing()) {
+            uint64_t now = monotonic_usec();
+            if (now >= deadline)
+                break;
+            poll(&pfd, 1, (deadline - now + 999) / 1000);
+            if (ddc_check_events())
+                ddc_update();
         }
-        free(monitors[i].data);
     }
-    free(monitors);
+    cache_save();
 
-    brightness_init(display, verbose, excluded_outputs);
+    apply_thread_start();
+    return true;
+}
+
+/* Reconfigure after the outputs changed, keeping what we can */
+void brightness_reinit(void)
+{
+    struct monitor *old = monitors;
+    int n_old = n_monitors;
+    char current[17];
+
+    strcpy(current, monitors[cur_monitor].name);
+
+    apply_thread_stop(false);
+    gamma_precalc_stop();
+    build_monitors(brightness_get_screen(), old, n_old);
+    cache_save();
+    ddc_rescan();
+
+    /* Free what was not taken over, clones share data with their original */
+    for (int i = 1; i < n_old; i++) {
+        if (!old[i].is_clone && old[i].data)
+            free_monitor_data(old[i].data);
+    }
+    free(old);
+
+    /* Stay on the same monitor if it is still there */
+    cur_monitor = 0;
+    for (int i = 1; i < n_monitors; i++) {
+        if (!strcmp(monitors[i].name, current))
+            cur_monitor = i;
+    }
+
+    gamma_precalc_start();
+    apply_thread_start();
 }
 
 static bool get_brightness_state(void)
 {
-    if (!needs_update)
+    bool changed = false;
+
+    if (!check_pending)
         return false;
-    needs_update = false;
-    XRRScreenResources *screen = XRRGetScreenResources(display, DefaultRootWindow(display));
+    check_pending = false;
 
     for (int i = 1; i < n_monitors; i++) {
         if (monitors[i].is_clone)
@@ -513,21 +1121,56 @@ static bool get_brightness_state(void)
         struct monitor_data *m = monitors[i].data;
         if (m->crtc == 0)
             continue;
-        if (m->supported_methods[BACKLIGHT])
+        bool check_backlight = m->backlight_changed;
+        bool check_gamma = m->gamma_poll_due;
+        bool found = false;
+        m->backlight_changed = false;
+        m->gamma_poll_due = false;
+
+        if (check_backlight) {
+            /* Our own writes are reported too, ignore those. While the
+               knob moves they can lag behind what was asked for. */
+            uint32_t old_level = m->level[BACKLIGHT];
+            pthread_mutex_lock(&apply_mutex);
+            uint32_t written = m->written_backlight;
+            bool pending = m->backlight_pending;
+            pthread_mutex_unlock(&apply_mutex);
             get_backlight_level(m);
-        if (m->supported_methods[GAMMA])
-            get_gamma_values(m);
-            
-        for (int method = BACKLIGHT; method <= GAMMA; method++) {
-            if (m->supported_methods[method]) {
-                uint32_t min = m->min[method], max = m->max[method];
-                m->normalised_level[method] = (float)(m->level[method] - min) / (max - min);
+            if (pending || m->level[BACKLIGHT] == written) {
+                m->level[BACKLIGHT] = old_level;
+            } else if (m->level[BACKLIGHT] != old_level) {
+                uint32_t min = m->min[BACKLIGHT], max = m->max[BACKLIGHT];
+                m->normalised_level[BACKLIGHT] = (float)(m->level[BACKLIGHT] - min) / (max - min);
+                found = true;
+            }
+        }
+        if (m->sysfs && sysfs_take_changed(m->sysfs)) {
+            /* Our own writes are reported too, sysfs_read_change() tells
+               them apart, even when they lag behind the last one */
+            uint32_t level;
+            if (sysfs_read_change(m->sysfs, &level) && level != m->level[SYSFS]) {
+                m->level[SYSFS] = level;
+                m->normalised_level[SYSFS] = (float)m->level[SYSFS] / m->max[SYSFS];
+                found = true;
+            }
+        }
+        if (check_gamma) {
+            if (get_gamma_values(m, false)) {
+                uint32_t min = m->min[GAMMA], max = m->max[GAMMA];
+                m->normalised_level[GAMMA] = (float)(m->level[GAMMA] - min) / (max - min);
+                m->poll_interval = GAMMA_POLL_MIN;
+                found = true;
+            } else {
+                m->poll_interval = MIN(2 * m->poll_interval, GAMMA_POLL_MAX);
             }
+            m->next_poll = monotonic_usec() + m->poll_interval;
         }
+        if (!found)
+            continue;
         m->actual_level = m->normalised_level[m->current_method];
+        changed = true;
     }
-    XRRFreeScreenResources(screen);
-    return true;
+    return changed;
 }
 
 static void set_brightness_state(void)
@@ -548,26 +1191,183 @@ static void set_brightness_state(void)
             set_backlight_level(m);
         } else if (m->current_method == GAMMA) {
             set_brightness_level(m);
+        } else if (m->current_method == SYSFS) {
+            set_sysfs_level(m);
+        } else if (m->current_method == DDC) {
+            set_ddc_level(m);
+        }
+    }
+}
+
+/* Mark the outputs that are due for a look at their levels */
+static void poll_outputs(void)
+{
+    uint64_t now = monotonic_usec();
+    bool poll_backlight = now >= next_backlight_poll;
+
+    if (poll_backlight)
+        next_backlight_poll = now + BACKLIGHT_POLL;
+
+    for (int i = 1; i < n_monitors; i++) {
+        struct monitor_data *m = monitors[i].data;
+        if (monitors[i].is_clone || m->crtc == 0)
+            continue;
+        if (m->supported_methods[BACKLIGHT] && poll_backlight) {
+            m->backlight_changed = true;
+            check_pending = true;
+        }
+        if (m->supported_methods[GAMMA] && now >= m->next_poll) {
+            m->gamma_poll_due = true;
+            check_pending = true;
+        }
+    }
+}
+
+/* Attach the monitors to the DDC/CI buses that were found, and pick up
+   levels the bus threads read. Returns true if a level changed. */
+static bool ddc_update(void)
+{
+    bool changed = false;
+
+    for (int i = 1; i < n_monitors; i++) {
+        struct monitor_data *m = monitors[i].data;
+        if (monitors[i].is_clone)
+            continue;
+        struct ddc_bus *bus = ddc_find(m->edid_hash);
+        bool found = false;
+        if (bus != m->ddc) {
+            m->ddc = bus;
+            m->supported_methods[DDC] = bus != NULL;
+            if (bus) {
+                m->min[DDC] = 0;
+                m->max[DDC] = ddc_get_max(bus);
+                if (verbose)
+                    printf("%s can be controlled through DDC/CI\n", monitors[i].name);
+                /* Better than gamma, unless the user said otherwise */
+                if (m->preferred_method == DDC
+                    || (m->preferred_method == NONE
+                        && (m->current_method == GAMMA || m->current_method == NONE)))
+                    m->current_method = DDC;
+            } else if (m->current_method == DDC) {
+                m->current_method = method_pick(m->supported_methods, m->preferred_method);
+            }
+            found = true;
+        }
+        if (bus && ddc_take_changed(bus)) {
+            m->level[DDC] = ddc_get_level(bus);
+            m->normalised_level[DDC] = (float)m->level[DDC] / m->max[DDC];
+            found = true;
         }
+        if (!found)
+            continue;
+        m->actual_level = m->normalised_level[m->current_method];
+        changed = true;
     }
+    return changed;
+}
+
+/* Apply whatever is still pending, before exiting */
+void brightness_flush(void)
+{
+    gamma_precalc_stop();
+    apply_thread_stop(true);
+    ddc_flush();
+}
+
+/* File descriptors the main loop should wake up for. Once one of them
+   is readable, brightness_is_changed() takes care of it. */
+int brightness_get_fds(int *fds, int max)
+{
+    int candidates[] = { wake_fd, sysfs_get_fd(), ddc_get_fd() };
+    int n = 0;
+
+    for (int i = 0; i < (int)lengthof(candidates) && n < max; i++) {
+        if (candidates[i] >= 0)
+            fds[n++] = candidates[i];
+    }
+    return n;
+}
+
+/* Milliseconds until brightness_is_changed() has something to do even
+   if no file descriptor woke us up, -1 if that never happens */
+int brightness_get_timeout(void)
+{
+    uint64_t now = monotonic_usec();
+    uint64_t next = 0;
+
+    for (int i = 1; i < n_monitors; i++) {
+        struct monitor_data *m = monitors[i].data;
+        if (monitors[i].is_clone || !m->supported_methods[GAMMA])
+            continue;
+        if (!m->gamma_loaded)
+            return GAMMA_LOAD_INTERVAL;
+        if (config.poll && m->crtc != 0 && (next == 0 || m->next_poll < next))
+            next = m->next_poll;
+    }
+    if (config.poll) {
+        for (int i = 1; i < n_monitors; i++) {
+            struct monitor_data *m = monitors[i].data;
+            if (!monitors[i].is_clone && m->crtc != 0 && m->supported_methods[BACKLIGHT]
+                && (next == 0 || next_backlight_poll < next))
+                next = next_backlight_poll;
+        }
+    }
+    if (next == 0)
+        return -1;
+    return next > now ? (next - now + 999) / 1000 : 0;
 }
 
 bool brightness_is_changed(void)
 {
-    return get_brightness_state();
+    uint64_t count;
+
+    if (wake_fd >= 0 && read(wake_fd, &count, sizeof(count)) < 0) {
+        /* Nothing written since last time */
+    }
+    if (config.poll)
+        poll_outputs();
+    if (sysfs_check_events())
+        check_pending = true;
+    bool changed = ddc_check_events() && ddc_update();
+    if (get_brightness_state() || changed)
+        return true;
+    /* Nothing else going on, take the time to read back a ramp */
+    return gamma_load_next();
+}
+
+/* The server reported that an output property changed */
+void brightness_property_changed(RROutput output, Atom property)
+{
+    for (int i = 1; i < n_monitors; i++) {
+        struct monitor_data *m = monitors[i].data;
+        if (m->output == output && m->supported_methods[BACKLIGHT]
+            && m->backlight_atom == property) {
+            m->backlight_changed = true;
+            check_pending = true;
+        }
+    }
 }
 
 static float get_average_level(void)
 {
-    float total = 0;
-    int count = 0;
+    float total = 0, unknown_total = 0;
+    int count = 0, unknown_count = 0;
     for (int i = 1; i < n_monitors; i++) {
         if (monitors[i].is_clone || monitors[i].data->crtc == 0)
             continue;
         enum method method = monitors[i].data->current_method;
-        total += CLAMP(monitors[i].data->normalised_level[method] + global_offset, 0.0, 1.0);
+        float level = CLAMP(monitors[i].data->normalised_level[method] + global_offset, 0.0, 1.0);
+        /* The level of a ramp that was not read back is only a guess */
+        if (method == GAMMA && !monitors[i].data->gamma_loaded) {
+            unknown_total += level;
+            unknown_count++;
+            continue;
+        }
+        total += level;
         count++;
     }
+    if (count == 0)
+        return unknown_count ? unknown_total / unknown_count : 0.0;
     return total / count;
 }
 
@@ -625,16 +1425,30 @@ int brightness_get_percent(void)
 void brightness_set_level(float level)
 {
     struct monitor_data *m = monitors[cur_monitor].data;
+    gamma_load_selected();
+    assert((level >= 0.0) && (level <= 1.0));
     if (cur_monitor > 0) {
-        assert((level >= 0.0) && (level <= 1.0));
         m->normalised_level[m->current_method] = level;
-        set_brightness_state();
+    } else {
+        /* Every monitor ends up at the same level */
+        for (int i = 1; i < n_monitors; i++) {
+            struct monitor_data *d = monitors[i].data;
+            if (monitors[i].is_clone || d->crtc == 0)
+                continue;
+            d->normalised_level[d->current_method] = level;
+            d->actual_level = level;
+        }
+        global_offset = 0;
+        m->normalised_level[NONE] = level;
+        m->actual_level = level;
     }
+    set_brightness_state();
 }
 
 void brightness_set_level_rel(float delta_level)
 {
     struct monitor_data *m = monitors[cur_monitor].data;
+    gamma_load_selected();
     if (cur_monitor > 0) {
         m->normalised_level[m->current_method] = CLAMP(m->normalised_level[m->current_method] + delta_level, 0.0, 1.0);
     } else {
@@ -664,6 +1478,11 @@ const char *brightness_get_monitor_name(void)
     return monitors[cur_monitor].name;
 }
 
+const char *brightness_get_output_name(int monitor)
+{
+    return monitors[monitor].name;
+}
+
 void brightness_set_monitor_rel(int delta_monitor)
 {
     cur_monitor = (cur_monitor + delta_monitor) % n_monitors;
@@ -671,6 +1490,19 @@ void brightness_set_monitor_rel(int delta_monitor)
         cur_monitor += n_monitors;
     
     get_brightness_state();
+    gamma_load_selected();
+}
+
+/* Select a monitor by output name, or "ALL" */
+bool brightness_set_monitor(const char *name)
+{
+    for (int i = 0; i < n_monitors; i++) {
+        if (strcasecmp(monitors[i].name, name) == 0) {
+            brightness_set_monitor_rel(i - cur_monitor);
+            return true;
+        }
+    }
+    return false;
 }
 
 int brightness_get_current_monitor(void)
@@ -696,6 +1528,18 @@ bool brightness_has_method(enum method method)
     }
 }
 
+/* Look up a method by its name, as shown by brightness_get_method_name() */
+bool brightness_parse_method(const char *name, enum method *method)
+{
+    for (int i = BACKLIGHT; i < (int)lengthof(methods); i++) {
+        if (strcasecmp(methods[i], name) == 0) {
+            *method = i;
+            return true;
+        }
+    }
+    return false;
+}
+
 enum method brightness_get_method(void)
 {
     if (cur_monitor == 0) {
@@ -718,19 +1562,32 @@ enum method brightness_get_method(void)
 
 bool brightness_set_method(enum method method)
 {
+    if (method == GAMMA)
+        gamma_load_selected();
     if (cur_monitor == 0) {
         bool success = false;
         for (int i = 1; i < n_monitors; i++) {
             if (monitors[i].data->supported_methods[method]) {
                 monitors[i].data->current_method = method;
+                monitors[i].data->preferred_method = method;
+                /* Choices made for a single level change are not kept */
+                if (!oneshot)
+                    cache_set_method(monitors[i].data->edid_hash, method);
                 success = true;
             }
         }
+        if (!oneshot)
+            cache_save();
         return success;
     }
     struct monitor_data *m = monitors[cur_monitor].data;
     if (m->supported_methods[method]) {
         m->current_method = method;
+        m->preferred_method = method;
+        if (!oneshot) {
+            cache_set_method(m->edid_hash, method);
+            cache_save();
+        }
         return true;
     }
     return false;
@@ -0,0 +1,200 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * cache.c: remembering what outputs can do between runs
+ *
+ * The backlight range, gamma size and the method last used are kept per
+ * monitor in $XDG_CACHE_HOME/wmbright/outputs, keyed by a hash of the
+ * EDID. The file is a small header followed by an array of struct
+ * output_caps in host byte order; anything that doesn't look right is
+ * ignored and rebuilt from probing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "include/common.h"
+#include "include/cache.h"
+
+
+#define CACHE_MAGIC 0x63426d77      /* "wmBc" */
+#define CACHE_VERSION 2
+#define CACHE_MAX_ENTRIES 32
+
+struct cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t entry_size;
+};
+
+static struct output_caps entries[CACHE_MAX_ENTRIES];
+static int n_entries = 0;
+static bool dirty = false;
+static bool verbose = false;
+
+uint64_t cache_hash(const unsigned char *data, int length)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (int i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash ? hash : 1;
+}
+
+/* Put the path of the cache directory, or the file in it, in buf */
+static bool cache_path(char *buf, size_t size, bool file)
+{
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *suffix = file ? "/wmbright/outputs" : "/wmbright";
+    int n;
+
+    if (base && base[0] == '/') {
+        n = snprintf(buf, size, "%s%s", base, suffix);
+    } else {
+        const char *home = getenv("HOME");
+        if (home == NULL)
+            return false;
+        n = snprintf(buf, size, "%s/.cache%s", home, suffix);
+    }
+    return n > 0 && (size_t)n < size;
+}
+
+void cache_load(bool set_verbose)
+{
+    char filename[512];
+    struct cache_header header;
+    FILE *fp;
+
+    verbose = set_verbose;
+    n_entries = 0;
+    dirty = false;
+    if (!cache_path(filename, sizeof(filename), true))
+        return;
+    fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return;
+    if (fread(&header, sizeof(header), 1, fp) == 1
+        && header.magic == CACHE_MAGIC
+        && header.version == CACHE_VERSION
+        && header.entry_size == sizeof(struct output_caps)
+        && header.count <= CACHE_MAX_ENTRIES
+        && fread(entries, sizeof(struct output_caps), header.count, fp) == header.count) {
+        n_entries = header.count;
+        if (verbose)
+            printf("Loaded %d cached output(s) from %s\n", n_entries, filename);
+    } else {
+        fprintf(stderr, "wmbright:warning: ignoring invalid cache file \"%s\"\n", filename);
+    }
+    fclose(fp);
+}
+
+const struct output_caps *cache_lookup(uint64_t edid_hash)
+{
+    if (edid_hash == 0)
+        return NULL;
+    for (int i = 0; i < n_entries; i++) {
+        if (entries[i].edid_hash == edid_hash)
+            return &entries[i];
+    }
+    return NULL;
+}
+
+void cache_forget(uint64_t edid_hash)
+{
+    for (int i = 0; i < n_entries; i++) {
+        if (entries[i].edid_hash == edid_hash) {
+            memmove(&entries[i], &entries[i + 1], (n_entries - i - 1) * sizeof(struct output_caps));
+            n_entries--;
+            dirty = true;
+            return;
+        }
+    }
+}
+
+void cache_store(const struct output_caps *caps)
+{
+    if (caps->edid_hash == 0)
+        return;
+    cache_forget(caps->edid_hash);
+    /* Full, the monitor seen the longest time ago goes */
+    if (n_entries == CACHE_MAX_ENTRIES)
+        cache_forget(entries[0].edid_hash);
+    entries[n_entries] = *caps;
+    memset(entries[n_entries].pad, 0, sizeof(entries[n_entries].pad));
+    n_entries++;
+    dirty = true;
+}
+
+void cache_set_method(uint64_t edid_hash, int method)
+{
+    for (int i = 0; i < n_entries; i++) {
+        if (entries[i].edid_hash == edid_hash && entries[i].method != method) {
+            entries[i].method = method;
+            dirty = true;
+        }
+    }
+}
+
+void cache_save(void)
+{
+    char dirname[512], filename[512], tmpname[520];
+    struct cache_header header = { CACHE_MAGIC, CACHE_VERSION, n_entries,
+                                   sizeof(struct output_caps) };
+    FILE *fp;
+
+    if (!dirty)
+        return;
+    dirty = false;
+    if (!cache_path(dirname, sizeof(dirname), false)
+        || !cache_path(filename, sizeof(filename), true))
+        return;
+    /* The parent usually exists already, but not necessarily */
+    char *slash = strrchr(dirname, '/');
+    *slash = '\0';
+    mkdir(dirname, 0700);
+    *slash = '/';
+    if (mkdir(dirname, 0700) != 0 && errno != EEXIST) {
+        fprintf(stderr, "wmbright:warning: could not create cache directory \"%s\"\n", dirname);
+        return;
+    }
+
+    /* Write a new file and move it in place, so nobody sees half of it */
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+    fp = fopen(tmpname, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "wmbright:warning: could not write cache file \"%s\"\n", tmpname);
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+        && fwrite(entries, sizeof(struct output_caps), n_entries, fp) == (size_t)n_entries;
+    if (fclose(fp) != 0 || !ok || rename(tmpname, filename) != 0) {
+        fprintf(stderr, "wmbright:warning: could not write cache file \"%s\"\n", filename);
+        remove(tmpname);
+        return;
+    }
+    if (verbose)
+        printf("Saved %d output(s) to %s\n", n_entries, filename);
+}
@@ -43,6 +43,27 @@
     "  -k        disable grabbing of brightness control keys\n"     \
     "  -o        disable osd\n"                                     \
     "  -v        verbose\n"                                         \
+    "  --daemon         run without the dockapp and OSD windows\n"   \
+    "  --stream         print output, method and percent on changes\n" \
+    "  --set <level>    set the level, e.g. 40%, +5 or -5, and exit\n" \
+    "  --output <name>  with --set, change only this output\n"     \
+    "  --method <name>  with --set, use backlight, gamma, sysfs or ddc\n" \
+
+/* Values returned by getopt_long for options that only have a long form */
+#define OPT_SET    256
+#define OPT_OUTPUT 257
+#define OPT_METHOD 258
+#define OPT_DAEMON 259
+#define OPT_STREAM 260
+
+static const struct option long_options[] = {
+    { "set",    required_argument, NULL, OPT_SET },
+    { "output", required_argument, NULL, OPT_OUTPUT },
+    { "method", required_argument, NULL, OPT_METHOD },
+    { "daemon", no_argument,       NULL, OPT_DAEMON },
+    { "stream", no_argument,       NULL, OPT_STREAM },
+    { NULL, 0, NULL, 0 }
+};
 
 /* The global configuration */
 struct _Config config;
@@ -64,7 +85,11 @@ void config_init(void)
     config.wheel_button_down = 5;
     config.scrollstep = 0.03;
     config.osd = 1;
+    config.ddc = 1;
+    config.control = 1;
+    config.shm = 1;
     config.osd_color = (char *) default_osd_color;
+    config.settle_time = 250;
 }
 
 /*
@@ -83,6 +108,15 @@ void config_release(void)
 
     if (config.osd_color != default_osd_color)
         free(config.osd_color);
+
+    if (config.sysfs_root)
+        free(config.sysfs_root);
+
+    if (config.ddc_root)
+        free(config.ddc_root);
+
+    if (config.control_socket)
+        free(config.control_socket);
 }
 
 /*
@@ -101,18 +135,24 @@ void parse_cli_options(int argc, char **argv)
     config.verbose = false;
     error_found = false;
     for (;;) {
-        opt = getopt(argc, argv, ":d:e:f:hkm:ov");
+        opt = getopt_long(argc, argv, ":d:e:f:hkm:ov", long_options, NULL);
         if (opt == -1)
             break;
 
         switch (opt) {
         case '?':
-            fprintf(stderr, "wmbright:error: unknown option '-%c'\n", optopt);
+            if (optopt)
+                fprintf(stderr, "wmbright:error: unknown option '-%c'\n", optopt);
+            else
+                fprintf(stderr, "wmbright:error: unknown option '%s'\n", argv[optind - 1]);
             error_found = true;
             break;
 
         case ':':
-            fprintf(stderr, "wmbright:error: missing argument for option '-%c'\n", optopt);
+            if (optopt >= OPT_SET)
+                fprintf(stderr, "wmbright:error: missing argument for option '%s'\n", argv[optind - 1]);
+            else
+                fprintf(stderr, "wmbright:error: missing argument for option '-%c'\n", optopt);
             error_found = true;
             break;
         case 'd':
@@ -153,6 +193,32 @@ void parse_cli_options(int argc, char **argv)
             config.verbose = true;
             break;
 
+        case OPT_SET:
+            if (config.set_level)
+                free(config.set_level);
+            config.set_level = strdup(optarg);
+            break;
+
+        case OPT_OUTPUT:
+            if (config.set_output)
+                free(config.set_output);
+            config.set_output = strdup(optarg);
+            break;
+
+        case OPT_DAEMON:
+            config.daemon = true;
+            break;
+
+        case OPT_STREAM:
+            config.stream = true;
+            break;
+
+        case OPT_METHOD:
+            if (config.set_method)
+                free(config.set_method);
+            config.set_method = strdup(optarg);
+            break;
+
         default:
             break;
         }
@@ -164,6 +230,11 @@ void parse_cli_options(int argc, char **argv)
         error_found = true;
     }
 
+    if (!config.set_level && (config.set_output || config.set_method)) {
+        fprintf(stderr, "wmbright:error: --output and --method only go with --set\n");
+        error_found = true;
+    }
+
     if (error_found)
         exit(EXIT_FAILURE);
 
@@ -267,7 +338,18 @@ void config_read(void)
         *ptr = '\0';
 
         /* Check what keyword we have */
-        if (strcmp(keyword, "exclude") == 0) {
+        if (strcmp(keyword, "control") == 0) {
+            config.control = atoi(value);
+
+        } else if (strcmp(keyword, "ddc") == 0) {
+            config.ddc = atoi(value);
+
+        } else if (strcmp(keyword, "ddcroot") == 0) {
+            if (config.ddc_root)
+                free(config.ddc_root);
+            config.ddc_root = strdup(value);
+
+        } else if (strcmp(keyword, "exclude") == 0) {
             int i;
 
             for (i = 0; i < EXCLUDE_MAX_COUNT; i++) {
@@ -280,6 +362,9 @@ void config_read(void)
                 if (strcmp(value, config.exclude_output[i]) == 0)
                     break;
             }
+        } else if (strcmp(keyword, "gammarate") == 0) {
+            config.gamma_rate = atoi(value);
+
         } else if (strcmp(keyword, "mousewheel") == 0) {
             config.mousewheel = atoi(value);
 
@@ -291,9 +376,28 @@ void config_read(void)
                 free(config.osd_color);
             config.osd_color = strdup(value);
 
+        } else if (strcmp(keyword, "poll") == 0) {
+            config.poll = atoi(value);
+
         } else if (strcmp(keyword, "scrolltext") == 0) {
             config.scrolltext = atoi(value);
 
+        } else if (strcmp(keyword, "settletime") == 0) {
+            config.settle_time = atoi(value);
+
+        } else if (strcmp(keyword, "shm") == 0) {
+            config.shm = atoi(value);
+
+        } else if (strcmp(keyword, "socket") == 0) {
+            if (config.control_socket)
+                free(config.control_socket);
+            config.control_socket = strdup(value);
+
+        } else if (strcmp(keyword, "sysfsroot") == 0) {
+            if (config.sysfs_root)
+                free(config.sysfs_root);
+            config.sysfs_root = strdup(value);
+
         } else if (strcmp(keyword, "wheelbtn1") == 0) {
             config.wheel_button_up = atoi(value);
 
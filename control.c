@@ -0,0 +1,388 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * control.c: remote control through a UNIX socket
+ *
+ * Scripts and hotkey daemons connect to a socket in $XDG_RUNTIME_DIR and
+ * send text commands, one per line or separated by semicolons:
+ *
+ *   set <percent>        set the level of the selected output
+ *   inc [percent]        raise it, by the wheel step by default
+ *   dec [percent]        lower it, by the wheel step by default
+ *   output <name>        select an output by name, ALL, next or prev
+ *   method <name>        switch method: backlight, gamma, sysfs or ddc
+ *   get                  reply with output, method and percent
+ *   outputs              reply with the names of all outputs
+ *
+ * Every command gets one line back, "ok", "error <reason>" or the answer.
+ * Commands run on the main loop, everything that arrived since it last
+ * woke up is applied before the dockapp is redrawn once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <X11/Xlib.h>
+#include <X11/extensions/Xrandr.h>
+
+#include "include/common.h"
+#include "include/config.h"
+#include "include/brightness.h"
+#include "include/control.h"
+
+
+/* Longest command line accepted */
+#define LINE_MAX_LENGTH 256
+
+struct client {
+    int fd;                         /* -1 when the slot is free */
+    bool broken;                    /* Could not be written to, drop it */
+    size_t length;
+    char buffer[LINE_MAX_LENGTH];
+};
+
+static int listen_fd = -1;
+static char *socket_path = NULL;
+static struct client clients[CONTROL_MAX_CLIENTS];
+static bool verbose = false;
+
+
+static void reply(struct client *c, const char *format, ...)
+{
+    char line[LINE_MAX_LENGTH];
+    va_list ap;
+    int n;
+
+    va_start(ap, format);
+    n = vsnprintf(line, sizeof(line) - 1, format, ap);
+    va_end(ap);
+    if (n < 0)
+        return;
+    if (n > (int)sizeof(line) - 2)
+        n = sizeof(line) - 2;
+    line[n++] = '\n';
+    /* Clients that don't read their replies don't get to hold us up */
+    if (send(c->fd, line, n, MSG_NOSIGNAL | MSG_DONTWAIT) != n)
+        c->broken = true;
+}
+
+/* A percentage, optionally followed by '%' */
+static bool parse_percent(const char *text, float *value)
+{
+    char *end;
+
+    if (text == NULL)
+        return false;
+    *value = strtof(text, &end);
+    if (end == text)
+        return false;
+    if (*end == '%')
+        end++;
+    return *end == '\0';
+}
+
+static int run_command(struct client *c, char *line)
+{
+    char *save;
+    char *command = strtok_r(line, " \t\r", &save);
+    char *arg = strtok_r(NULL, " \t\r", &save);
+    float value;
+
+    if (command == NULL)
+        return 0;
+
+    if (strcmp(command, "set") == 0) {
+        if (!parse_percent(arg, &value)) {
+            reply(c, "error usage: set <percent>");
+            return 0;
+        }
+        brightness_set_level(CLAMP(value / 100.0, 0.0, 1.0));
+        reply(c, "ok");
+        return CONTROL_LEVEL;
+
+    } else if (strcmp(command, "inc") == 0 || strcmp(command, "dec") == 0) {
+        if (arg == NULL) {
+            value = config.scrollstep * 100.0;
+        } else if (!parse_percent(arg, &value)) {
+            reply(c, "error usage: %s [percent]", command);
+            return 0;
+        }
+        if (command[0] == 'd')
+            value = -value;
+        brightness_ready();
+        brightness_set_level_rel(value / 100.0);
+        brightness_unready();
+        reply(c, "ok");
+        return CONTROL_LEVEL;
+
+    } else if (strcmp(command, "output") == 0) {
+        if (arg == NULL) {
+            reply(c, "error usage: output <name|next|prev>");
+            return 0;
+        }
+        if (strcmp(arg, "next") == 0) {
+            brightness_set_monitor_rel(1);
+        } else if (strcmp(arg, "prev") == 0) {
+            brightness_set_monitor_rel(-1);
+        } else if (!brightness_set_monitor(arg)) {
+            reply(c, "error unknown output %s", arg);
+            return 0;
+        }
+        reply(c, "ok");
+        return CONTROL_OUTPUT;
+
+    } else if (strcmp(command, "method") == 0) {
+        enum method method;
+
+        if (arg == NULL || !brightness_parse_method(arg, &method)) {
+            reply(c, "error usage: method <backlight|gamma|sysfs|ddc>");
+            return 0;
+        }
+        if (!brightness_set_method(method)) {
+            reply(c, "error %s not supported by %s", arg, brightness_get_monitor_name());
+            return 0;
+        }
+        reply(c, "ok");
+        return CONTROL_METHOD;
+
+    } else if (strcmp(command, "get") == 0) {
+        reply(c, "%s %s %d", brightness_get_monitor_name(),
+              brightness_get_method_name(-1), brightness_get_percent());
+        return 0;
+
+    } else if (strcmp(command, "outputs") == 0) {
+        char names[LINE_MAX_LENGTH] = "";
+        size_t used = 0;
+
+        for (int i = 0; i <= brightness_get_monitor_count() && used < sizeof(names); i++)
+            used += snprintf(names + used, sizeof(names) - used, "%s%s",
+                             i > 0 ? " " : "", brightness_get_output_name(i));
+        reply(c, "%s", names);
+        return 0;
+    }
+
+    reply(c, "error unknown command %s", command);
+    return 0;
+}
+
+/* Run every complete command in the buffer, keeping what is left. At
+   the end of the stream, what is left is a command too. */
+static int run_buffer(struct client *c, bool end)
+{
+    size_t start = 0;
+    int changes = 0;
+
+    for (size_t i = 0; i < c->length && !c->broken; i++) {
+        if (c->buffer[i] != '\n' && c->buffer[i] != ';')
+            continue;
+        c->buffer[i] = '\0';
+        changes |= run_command(c, c->buffer + start);
+        start = i + 1;
+    }
+    c->length -= start;
+    memmove(c->buffer, c->buffer + start, c->length);
+    if (end && c->length > 0 && !c->broken) {
+        c->buffer[c->length] = '\0';
+        changes |= run_command(c, c->buffer);
+        c->length = 0;
+    }
+    return changes;
+}
+
+static void drop_client(struct client *c)
+{
+    close(c->fd);
+    c->fd = -1;
+}
+
+static void accept_clients(void)
+{
+    int fd;
+
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        struct client *c = NULL;
+
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        for (int i = 0; i < CONTROL_MAX_CLIENTS && !c; i++) {
+            if (clients[i].fd < 0)
+                c = &clients[i];
+        }
+        if (!c) {
+            fprintf(stderr, "wmbright:warning: too many control clients, refusing one\n");
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->broken = false;
+        c->length = 0;
+    }
+}
+
+bool control_init(const char *path, const char *display_name, bool set_verbose)
+{
+    struct sockaddr_un addr;
+    char default_path[sizeof(addr.sun_path) + 1];
+
+    verbose = set_verbose;
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+
+    if (path == NULL) {
+        const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+        size_t prefix;
+
+        if (runtime_dir == NULL || runtime_dir[0] == '\0') {
+            fprintf(stderr, "wmbright:warning: $XDG_RUNTIME_DIR not set, no control socket\n");
+            return false;
+        }
+        /* One per display, so instances on different seats stay apart */
+        prefix = snprintf(default_path, sizeof(default_path), "%s/wmbright-", runtime_dir);
+        snprintf(default_path + MIN(prefix, sizeof(default_path) - 1),
+                 sizeof(default_path) - MIN(prefix, sizeof(default_path) - 1),
+                 "%s", display_name);
+        for (char *p = default_path + MIN(prefix, sizeof(default_path) - 1); *p; p++) {
+            if (*p == '/')
+                *p = '_';
+        }
+        path = default_path;
+    }
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "wmbright:warning: control socket path \"%s\" is too long\n", path);
+        return false;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+        goto fail;
+
+    mode_t old_mask = umask(077);
+    int result = bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (result < 0 && errno == EADDRINUSE) {
+        /* Left behind by an instance that went away, unless it is still there */
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool in_use = probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (probe >= 0)
+            close(probe);
+        if (in_use) {
+            umask(old_mask);
+            fprintf(stderr, "wmbright:warning: another wmbright is listening on \"%s\"\n", path);
+            close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        unlink(path);
+        result = bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    }
+    umask(old_mask);
+    if (result < 0 || listen(listen_fd, CONTROL_MAX_CLIENTS) < 0)
+        goto fail;
+
+    socket_path = strdup(path);
+    if (verbose)
+        printf("Listening for commands on %s\n", path);
+    return true;
+
+fail:
+    fprintf(stderr, "wmbright:warning: could not create control socket \"%s\": %s\n",
+            path, strerror(errno));
+    if (listen_fd >= 0)
+        close(listen_fd);
+    listen_fd = -1;
+    return false;
+}
+
+int control_get_fds(int *fds, int max)
+{
+    int n = 0;
+
+    if (listen_fd < 0)
+        return 0;
+    if (n < max)
+        fds[n++] = listen_fd;
+    for (int i = 0; i < CONTROL_MAX_CLIENTS && n < max; i++) {
+        if (clients[i].fd >= 0)
+            fds[n++] = clients[i].fd;
+    }
+    return n;
+}
+
+int control_process(void)
+{
+    int changes = 0;
+
+    if (listen_fd < 0)
+        return 0;
+    accept_clients();
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        struct client *c = &clients[i];
+        ssize_t n = 0;
+
+        if (c->fd < 0)
+            continue;
+        while (!c->broken
+               && (n = read(c->fd, c->buffer + c->length,
+                            sizeof(c->buffer) - 1 - c->length)) > 0) {
+            c->length += n;
+            changes |= run_buffer(c, false);
+            if (c->length == sizeof(c->buffer) - 1) {
+                reply(c, "error line too long");
+                c->broken = true;
+            }
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EINTR) && !c->broken)
+            continue;
+        /* End of the stream, or something went wrong */
+        if (!c->broken)
+            changes |= run_buffer(c, true);
+        drop_client(c);
+    }
+    return changes;
+}
+
+void control_close(void)
+{
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0)
+            drop_client(&clients[i]);
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+    if (socket_path) {
+        unlink(socket_path);
+        free(socket_path);
+        socket_path = NULL;
+    }
+}
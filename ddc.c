@@ -0,0 +1,633 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * ddc.c: backlight of external monitors through DDC/CI
+ *
+ * External monitors take their brightness as VCP feature 0x10 over the
+ * i2c bus of their video cable. A transaction takes 40-100 ms including
+ * the delays the protocol demands, so each bus gets a thread of its own
+ * with a queue of one: a new level replaces the one still waiting to be
+ * written. The values last read or written are kept, so nobody ever
+ * waits for the bus.
+ *
+ * Buses are matched to outputs by EDID, which the monitor also answers
+ * on the same bus. Entries named i2c-* under the root are either real
+ * i2c device nodes, or, for testing, directories standing in for a
+ * monitor: an "edid" file and a "vcp" file holding the current and max
+ * brightness. The fake speaks the same packets as a real monitor. It
+ * appends every level it is given to a "log" file, and refuses as many
+ * writes as a "nak" file says.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "include/common.h"
+#include "include/cache.h"
+#include "include/ddc.h"
+
+
+#define DDC_ADDR 0x37
+#define EDID_ADDR 0x50
+#define EDID_LENGTH 128
+#define VCP_BRIGHTNESS 0x10
+
+/* Mandatory delays of the protocol, in us */
+#define DDC_REPLY_DELAY 40000       /* Between a request and reading its reply */
+#define DDC_COMMAND_DELAY 50000     /* Between the end of one command and the next */
+
+#define DDC_RETRIES 3
+#define DDC_REFRESH 5000000         /* Between reads of the level when polling */
+
+#define BUS_PROBE  0                /* Finding out what is on the bus */
+#define BUS_READY  1                /* Monitor with brightness control found */
+#define BUS_ABSENT 2
+
+struct ddc_bus;
+
+struct ddc_transport {
+    bool (*open)(struct ddc_bus *bus);
+    void (*close)(struct ddc_bus *bus);
+    bool (*read_edid)(struct ddc_bus *bus, unsigned char *edid);
+    bool (*write)(struct ddc_bus *bus, const unsigned char *data, int length);
+    bool (*read)(struct ddc_bus *bus, unsigned char *data, int length);
+};
+
+struct ddc_bus {
+    char name[32];
+    char path[512];
+    const struct ddc_transport *transport;
+    int fd;
+    int fake_request;               /* Feature asked for, fake transport only */
+    pthread_t thread;
+    pthread_mutex_t mutex;          /* Protects everything below */
+    pthread_cond_t cond;
+    int state;                      /* One of the BUS_ values */
+    uint64_t edid_hash;
+    uint32_t max, current;
+    uint32_t requested;
+    bool set_pending;
+    bool writing;                   /* requested is being written */
+    bool changed;
+    bool rescan;
+    bool quit;
+    uint64_t next_command;          /* Owned by the bus thread */
+    struct ddc_bus *next;
+};
+
+static struct ddc_bus *buses = NULL;
+static int event_fd = -1;
+static bool poll_level = false;
+static bool verbose = false;
+
+static uint64_t monotonic_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(uint64_t when)
+{
+    uint64_t now = monotonic_usec();
+    if (when > now)
+        usleep(when - now);
+}
+
+static uint8_t checksum(uint8_t init, const unsigned char *data, int length)
+{
+    for (int i = 0; i < length; i++)
+        init ^= data[i];
+    return init;
+}
+
+/* Mark a bus as changed and tell the main thread. Caller holds bus->mutex. */
+static void bus_changed(struct ddc_bus *bus)
+{
+    uint64_t one = 1;
+
+    bus->changed = true;
+    if (write(event_fd, &one, sizeof(one)) < 0) {
+        /* Only fails if the counter is about to overflow, still readable then */
+    }
+}
+
+/* Real i2c buses, /dev/i2c-N */
+
+static bool i2c_open(struct ddc_bus *bus)
+{
+    bus->fd = open(bus->path, O_RDWR | O_CLOEXEC);
+    return bus->fd >= 0;
+}
+
+static void i2c_close(struct ddc_bus *bus)
+{
+    if (bus->fd >= 0)
+        close(bus->fd);
+    bus->fd = -1;
+}
+
+static bool i2c_transfer(struct ddc_bus *bus, struct i2c_msg *msgs, int count)
+{
+    struct i2c_rdwr_ioctl_data data = { msgs, count };
+    return ioctl(bus->fd, I2C_RDWR, &data) == count;
+}
+
+static bool i2c_read_edid(struct ddc_bus *bus, unsigned char *edid)
+{
+    unsigned char offset = 0;
+    struct i2c_msg msgs[2] = {
+        { EDID_ADDR, 0, 1, &offset },
+        { EDID_ADDR, I2C_M_RD, EDID_LENGTH, edid }
+    };
+    return i2c_transfer(bus, msgs, 2);
+}
+
+static bool i2c_write(struct ddc_bus *bus, const unsigned char *data, int length)
+{
+    struct i2c_msg msg = { DDC_ADDR, 0, length, (unsigned char *)data };
+    return i2c_transfer(bus, &msg, 1);
+}
+
+static bool i2c_read(struct ddc_bus *bus, unsigned char *data, int length)
+{
+    struct i2c_msg msg = { DDC_ADDR, I2C_M_RD, length, data };
+    return i2c_transfer(bus, &msg, 1);
+}
+
+static const struct ddc_transport i2c_transport = {
+    i2c_open, i2c_close, i2c_read_edid, i2c_write, i2c_read
+};
+
+/* Fake buses, directories with an edid and a vcp file */
+
+static bool fake_file(struct ddc_bus *bus, const char *file, char *path, size_t size)
+{
+    return snprintf(path, size, "%s/%s", bus->path, file) < (int)size;
+}
+
+static bool fake_open(struct ddc_bus *bus)
+{
+    bus->fake_request = -1;
+    return true;
+}
+
+static void fake_close(__attribute__((unused)) struct ddc_bus *bus)
+{
+}
+
+static bool fake_read_edid(struct ddc_bus *bus, unsigned char *edid)
+{
+    char path[600];
+    FILE *fp;
+    bool ok;
+
+    if (!fake_file(bus, "edid", path, sizeof(path)) || !(fp = fopen(path, "rb")))
+        return false;
+    ok = fread(edid, 1, EDID_LENGTH, fp) == EDID_LENGTH;
+    fclose(fp);
+    return ok;
+}
+
+static bool fake_read_vcp(struct ddc_bus *bus, unsigned int *current, unsigned int *max)
+{
+    char path[600];
+    FILE *fp;
+    bool ok;
+
+    if (!fake_file(bus, "vcp", path, sizeof(path)) || !(fp = fopen(path, "r")))
+        return false;
+    ok = fscanf(fp, "%u %u", current, max) == 2;
+    fclose(fp);
+    return ok;
+}
+
+/* Play the monitor: check the packet and remember or carry out the command */
+static bool fake_write(struct ddc_bus *bus, const unsigned char *data, int length)
+{
+    char path[600];
+    unsigned int current, max;
+    FILE *fp;
+
+    if (length < 4 || data[0] != 0x51 || (data[1] & 0x7f) != length - 3
+        || checksum(DDC_ADDR << 1, data, length - 1) != data[length - 1])
+        return false;
+    if (data[2] == 0x01 && length == 5) {
+        bus->fake_request = data[3];
+        return true;
+    }
+    if (data[2] != 0x03 || length != 7)
+        return false;
+    if (fake_file(bus, "nak", path, sizeof(path)) && (fp = fopen(path, "r+"))) {
+        unsigned int naks = 0;
+        bool nak = fscanf(fp, "%u", &naks) == 1 && naks > 0;
+        if (nak) {
+            rewind(fp);
+            fprintf(fp, "%u\n", naks - 1);
+        }
+        fclose(fp);
+        if (nak)
+            return false;
+    }
+    if (data[3] != VCP_BRIGHTNESS || !fake_read_vcp(bus, &current, &max))
+        return true;            /* Monitors ignore what they don't know */
+    if (!fake_file(bus, "vcp", path, sizeof(path)) || !(fp = fopen(path, "w")))
+        return false;
+    fprintf(fp, "%u %u\n", MIN((unsigned int)(data[4] << 8 | data[5]), max), max);
+    fclose(fp);
+    if (fake_file(bus, "log", path, sizeof(path)) && (fp = fopen(path, "a"))) {
+        fprintf(fp, "%u\n", MIN((unsigned int)(data[4] << 8 | data[5]), max));
+        fclose(fp);
+    }
+    return true;
+}
+
+static bool fake_read(struct ddc_bus *bus, unsigned char *data, int length)
+{
+    unsigned int current = 0, max = 0;
+    int request = bus->fake_request;
+
+    bus->fake_request = -1;
+    if (request < 0 || length != 11)
+        return false;
+    bool supported = request == VCP_BRIGHTNESS && fake_read_vcp(bus, &current, &max);
+    data[0] = DDC_ADDR << 1;
+    data[1] = 0x88;
+    data[2] = 0x02;
+    data[3] = supported ? 0x00 : 0x01;
+    data[4] = request;
+    data[5] = 0x00;
+    data[6] = max >> 8;
+    data[7] = max & 0xff;
+    data[8] = current >> 8;
+    data[9] = current & 0xff;
+    data[10] = checksum(0x50, data, 10);
+    return true;
+}
+
+static const struct ddc_transport fake_transport = {
+    fake_open, fake_close, fake_read_edid, fake_write, fake_read
+};
+
+/* The protocol */
+
+static bool send_command(struct ddc_bus *bus, const unsigned char *payload, int length)
+{
+    unsigned char packet[8];
+
+    packet[0] = 0x51;
+    packet[1] = 0x80 | length;
+    memcpy(packet + 2, payload, length);
+    packet[length + 2] = checksum(DDC_ADDR << 1, packet, length + 2);
+    sleep_until(bus->next_command);
+    bool ok = bus->transport->write(bus, packet, length + 3);
+    bus->next_command = monotonic_usec() + DDC_COMMAND_DELAY;
+    return ok;
+}
+
+static bool get_vcp(struct ddc_bus *bus, uint8_t feature, uint32_t *current, uint32_t *max)
+{
+    unsigned char request[2] = { 0x01, feature };
+    unsigned char reply[11];
+
+    for (int i = 0; i < DDC_RETRIES; i++) {
+        if (!send_command(bus, request, sizeof(request)))
+            continue;
+        usleep(DDC_REPLY_DELAY);
+        bool ok = bus->transport->read(bus, reply, sizeof(reply));
+        bus->next_command = monotonic_usec() + DDC_COMMAND_DELAY;
+        if (!ok || reply[0] != DDC_ADDR << 1 || (reply[1] & 0x7f) != 8
+            || checksum(0x50, reply, 10) != reply[10] || reply[2] != 0x02
+            || reply[4] != feature)
+            continue;
+        if (reply[3] != 0x00)
+            return false;       /* Not supported, no point in asking again */
+        *max = reply[6] << 8 | reply[7];
+        *current = reply[8] << 8 | reply[9];
+        return true;
+    }
+    return false;
+}
+
+static bool set_vcp(struct ddc_bus *bus, uint8_t feature, uint32_t value)
+{
+    unsigned char request[4] = { 0x03, feature, value >> 8, value & 0xff };
+    return send_command(bus, request, sizeof(request));
+}
+
+/* Find out if there is a monitor with brightness control on the bus */
+static void probe_bus(struct ddc_bus *bus)
+{
+    static const unsigned char header[8] = { 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00 };
+    unsigned char edid[EDID_LENGTH];
+    uint32_t current = 0, max = 0;
+    uint64_t hash = 0;
+    bool found = false;
+
+    if (bus->transport->read_edid(bus, edid) && !memcmp(edid, header, sizeof(header))) {
+        hash = cache_hash(edid, EDID_LENGTH);
+        found = get_vcp(bus, VCP_BRIGHTNESS, &current, &max) && max > 0;
+    }
+
+    pthread_mutex_lock(&bus->mutex);
+    if (found) {
+        if (verbose)
+            printf("Found DDC/CI monitor on %s, range: (0, %u), current: %u\n",
+                   bus->name, max, current);
+        bus->state = BUS_READY;
+        bus->edid_hash = hash;
+        bus->max = max;
+        bus->current = current;
+        bus_changed(bus);
+    } else {
+        /* Also tells those waiting for the probe that it is over */
+        bus->state = BUS_ABSENT;
+        bus->edid_hash = 0;
+        bus_changed(bus);
+    }
+    pthread_mutex_unlock(&bus->mutex);
+}
+
+/* Read the level again, in case the monitor's own buttons were used */
+static void refresh_bus(struct ddc_bus *bus)
+{
+    uint32_t current, max;
+    bool ok = get_vcp(bus, VCP_BRIGHTNESS, &current, &max);
+
+    pthread_mutex_lock(&bus->mutex);
+    if (ok && !bus->set_pending && current != bus->current) {
+        bus->current = current;
+        bus_changed(bus);
+    }
+    pthread_mutex_unlock(&bus->mutex);
+}
+
+static void *do_bus(void *data)
+{
+    struct ddc_bus *bus = (struct ddc_bus *)data;
+    uint64_t next_refresh = 0;
+    int failures = 0;
+
+    pthread_mutex_lock(&bus->mutex);
+    while (true) {
+        if (bus->rescan && !bus->quit) {
+            bus->rescan = false;
+            bus->state = BUS_PROBE;
+            pthread_mutex_unlock(&bus->mutex);
+            probe_bus(bus);
+            next_refresh = monotonic_usec() + DDC_REFRESH;
+            pthread_mutex_lock(&bus->mutex);
+            continue;
+        }
+        if (bus->set_pending && bus->state != BUS_ABSENT) {
+            uint32_t level = bus->requested;
+            bus->set_pending = false;
+            bus->writing = true;
+            pthread_mutex_unlock(&bus->mutex);
+            bool ok = set_vcp(bus, VCP_BRIGHTNESS, level);
+            next_refresh = monotonic_usec() + DDC_REFRESH;
+            pthread_mutex_lock(&bus->mutex);
+            bus->writing = false;
+            if (ok) {
+                bus->current = level;
+                failures = 0;
+            } else if (bus->set_pending) {
+                /* A newer level replaces the one that failed */
+                failures = 0;
+            } else if (++failures < DDC_RETRIES) {
+                bus->set_pending = true;
+            } else {
+                fprintf(stderr, "wmbright:warning: could not set the level of the monitor on %s\n",
+                        bus->name);
+                failures = 0;
+                /* Back to the level it is still at */
+                bus_changed(bus);
+            }
+            continue;
+        }
+        if (bus->quit)
+            break;
+        if (poll_level && bus->state == BUS_READY) {
+            struct timespec ts = { next_refresh / 1000000, (next_refresh % 1000000) * 1000 };
+            if (pthread_cond_timedwait(&bus->cond, &bus->mutex, &ts) == ETIMEDOUT) {
+                pthread_mutex_unlock(&bus->mutex);
+                refresh_bus(bus);
+                next_refresh = monotonic_usec() + DDC_REFRESH;
+                pthread_mutex_lock(&bus->mutex);
+            }
+        } else {
+            pthread_cond_wait(&bus->cond, &bus->mutex);
+        }
+    }
+    pthread_mutex_unlock(&bus->mutex);
+    bus->transport->close(bus);
+    return NULL;
+}
+
+/* SMBus controllers share the i2c device nodes but never have monitors */
+static bool is_display_bus(const char *name)
+{
+    char path[300], adapter[64] = "";
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "/sys/bus/i2c/devices/%s/name", name);
+    fp = fopen(path, "r");
+    if (fp) {
+        if (!fgets(adapter, sizeof(adapter), fp))
+            adapter[0] = '\0';
+        fclose(fp);
+    }
+    return strncasecmp(adapter, "SMBus", 5) != 0;
+}
+
+static void start_bus(const char *root, const char *name)
+{
+    struct stat st;
+    struct ddc_bus *bus = (struct ddc_bus *)calloc(1, sizeof(struct ddc_bus));
+    pthread_condattr_t attr;
+
+    /* Bus names are short, anything that doesn't fit is not a bus */
+    if (snprintf(bus->name, sizeof(bus->name), "%s", name) >= (int)sizeof(bus->name)
+        || snprintf(bus->path, sizeof(bus->path), "%s/%s", root, name) >= (int)sizeof(bus->path))
+        goto fail;
+    if (stat(bus->path, &st) != 0)
+        goto fail;
+    if (S_ISDIR(st.st_mode))
+        bus->transport = &fake_transport;
+    else if (S_ISCHR(st.st_mode) && is_display_bus(name))
+        bus->transport = &i2c_transport;
+    else
+        goto fail;
+    bus->fd = -1;
+    if (!bus->transport->open(bus))
+        goto fail;
+
+    pthread_mutex_init(&bus->mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&bus->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    bus->state = BUS_PROBE;
+    bus->rescan = true;
+    if (pthread_create(&bus->thread, NULL, do_bus, bus) != 0) {
+        bus->transport->close(bus);
+        goto fail;
+    }
+    bus->next = buses;
+    buses = bus;
+    return;
+
+fail:
+    free(bus);
+}
+
+void ddc_init(const char *root, bool poll, bool set_verbose)
+{
+    DIR *dir;
+    struct dirent *entry;
+
+    verbose = set_verbose;
+    poll_level = poll;
+    if (!root)
+        root = DDC_DEFAULT_ROOT;
+    dir = opendir(root);
+    if (!dir)
+        return;
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0) {
+        fprintf(stderr, "wmbright:warning: could not create ddc event fd: %s\n",
+                strerror(errno));
+        closedir(dir);
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (!strncmp(entry->d_name, "i2c-", 4))
+            start_bus(root, entry->d_name);
+    }
+    closedir(dir);
+}
+
+void ddc_rescan(void)
+{
+    for (struct ddc_bus *bus = buses; bus; bus = bus->next) {
+        pthread_mutex_lock(&bus->mutex);
+        bus->rescan = true;
+        pthread_cond_signal(&bus->cond);
+        pthread_mutex_unlock(&bus->mutex);
+    }
+}
+
+struct ddc_bus *ddc_find(uint64_t edid_hash)
+{
+    struct ddc_bus *found = NULL;
+
+    if (edid_hash == 0)
+        return NULL;
+    for (struct ddc_bus *bus = buses; bus && !found; bus = bus->next) {
+        pthread_mutex_lock(&bus->mutex);
+        /* While rescanning, the monitor is most likely still there */
+        if (bus->state != BUS_ABSENT && bus->edid_hash == edid_hash)
+            found = bus;
+        pthread_mutex_unlock(&bus->mutex);
+    }
+    return found;
+}
+
+uint32_t ddc_get_max(struct ddc_bus *bus)
+{
+    pthread_mutex_lock(&bus->mutex);
+    uint32_t max = bus->max;
+    pthread_mutex_unlock(&bus->mutex);
+    return max;
+}
+
+uint32_t ddc_get_level(struct ddc_bus *bus)
+{
+    pthread_mutex_lock(&bus->mutex);
+    uint32_t level = (bus->set_pending || bus->writing) ? bus->requested : bus->current;
+    pthread_mutex_unlock(&bus->mutex);
+    return level;
+}
+
+void ddc_set_level(struct ddc_bus *bus, uint32_t level)
+{
+    pthread_mutex_lock(&bus->mutex);
+    bus->requested = MIN(level, bus->max);
+    bus->set_pending = true;
+    pthread_cond_signal(&bus->cond);
+    pthread_mutex_unlock(&bus->mutex);
+}
+
+bool ddc_is_probing(void)
+{
+    bool probing = false;
+
+    for (struct ddc_bus *bus = buses; bus && !probing; bus = bus->next) {
+        pthread_mutex_lock(&bus->mutex);
+        probing = bus->state == BUS_PROBE || bus->rescan;
+        pthread_mutex_unlock(&bus->mutex);
+    }
+    return probing;
+}
+
+int ddc_get_fd(void)
+{
+    return buses ? event_fd : -1;
+}
+
+bool ddc_check_events(void)
+{
+    uint64_t count;
+    return event_fd >= 0 && read(event_fd, &count, sizeof(count)) == sizeof(count);
+}
+
+bool ddc_take_changed(struct ddc_bus *bus)
+{
+    pthread_mutex_lock(&bus->mutex);
+    bool changed = bus->changed;
+    bus->changed = false;
+    pthread_mutex_unlock(&bus->mutex);
+    return changed;
+}
+
+void ddc_flush(void)
+{
+    for (struct ddc_bus *bus = buses; bus; bus = bus->next) {
+        pthread_mutex_lock(&bus->mutex);
+        bus->quit = true;
+        pthread_cond_signal(&bus->cond);
+        pthread_mutex_unlock(&bus->mutex);
+    }
+    for (struct ddc_bus *bus = buses; bus; bus = bus->next)
+        pthread_join(bus->thread, NULL);
+}
@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# Compare the memory used by the dockapp and by --daemon on the current
+# X session: resident and proportional set size from /proc, and, if
+# xrestop is installed, the pixmap memory the X server holds for each.
+#
+# usage: examples/memusage.sh [path to wmbright]
+
+WMBRIGHT=${1:-./wmbright}
+# Give it time to probe the outputs and draw
+SETTLE=3
+
+measure() {
+    # Another instance would own the control socket and shared memory
+    "$WMBRIGHT" "$@" >/dev/null 2>&1 &
+    pid=$!
+    sleep $SETTLE
+    if ! kill -0 $pid 2>/dev/null; then
+        echo "wmbright $* exited early" >&2
+        return 1
+    fi
+    rss=$(awk '/^VmRSS:/ { print $2 }' /proc/$pid/status)
+    pss=$(awk '/^Pss:/ { print $2 }' /proc/$pid/smaps_rollup 2>/dev/null)
+    pixmaps=
+    if command -v xrestop >/dev/null 2>&1; then
+        # Each client is a record starting with res-base, PID comes
+        # before pixmap bytes in it, so look at whole records
+        pixmaps=$(xrestop -b -m 1 | awk -v pid=$pid '
+            function record() {
+                if (owner == pid && bytes != "")
+                    print int(bytes / 1024)
+            }
+            /^res-base/ { record(); owner = ""; bytes = "" }
+            /^PID/ { owner = $3 }
+            /^pixmap bytes/ { bytes = $4 }
+            END { record() }')
+    fi
+    printf "%-10s VmRSS %6s KiB  Pss %6s KiB  X pixmaps %6s KiB\n" \
+        "${1:-dockapp}" "$rss" "${pss:-?}" "${pixmaps:-?}"
+    kill $pid
+    wait $pid 2>/dev/null
+}
+
+measure
+measure --daemon
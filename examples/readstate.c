@@ -0,0 +1,101 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * readstate.c: print the brightness state published by wmbright
+ *
+ *   readstate [-w] [display]
+ *
+ * Prints one line per output: name, method and percent, the selected
+ * output marked with '*'. With -w, keeps watching and prints the state
+ * again whenever it changes. Checking costs one memory read, so a bar
+ * can afford to do it on every refresh.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "../include/wmbright_state.h"
+
+
+static void print_state(const struct wmbright_state *state)
+{
+    for (uint32_t i = 0; i < state->count; i++)
+        printf("%s%s %s %u\n", i == state->selected ? "*" : "",
+               state->outputs[i].name, state->outputs[i].method, state->outputs[i].percent);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    const char *display = getenv("DISPLAY");
+    const struct wmbright_state *shared;
+    struct wmbright_state state;
+    char name[64];
+    int watch = 0;
+    int fd;
+
+    if (argc > 1 && !strcmp(argv[1], "-w")) {
+        watch = 1;
+        argc--;
+        argv++;
+    }
+    if (argc > 1)
+        display = argv[1];
+    if (display == NULL) {
+        fprintf(stderr, "readstate: no display given and $DISPLAY not set\n");
+        return EXIT_FAILURE;
+    }
+    snprintf(name, sizeof(name), "%s%s", WMBRIGHT_STATE_PREFIX, display);
+    for (char *p = name + 1; *p; p++) {
+        if (*p == '/')
+            *p = '_';
+    }
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "readstate: wmbright is not running on %s\n", display);
+        return EXIT_FAILURE;
+    }
+    shared = mmap(NULL, sizeof(*shared), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED) {
+        perror("readstate: mmap");
+        return EXIT_FAILURE;
+    }
+
+    if (!wmbright_state_read(shared, &state)) {
+        fprintf(stderr, "readstate: unknown state format\n");
+        return EXIT_FAILURE;
+    }
+    print_state(&state);
+    while (watch) {
+        usleep(100000);
+        if (wmbright_state_generation(shared) == state.generation)
+            continue;
+        if (wmbright_state_read(shared, &state)) {
+            printf("\n");
+            print_state(&state);
+        }
+    }
+    return EXIT_SUCCESS;
+}
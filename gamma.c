@@ -0,0 +1,227 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * gamma.c: generation of gamma ramps
+ *
+ * A ramp entry is trunc(min(x^e * b, 1) * (size - 1)) shifted into the
+ * MSBs of a 16-bit value, where x = i / (size - 1), e is the inverse of
+ * the gamma and b is the brightness. Only the x^e part is expensive and
+ * it does not depend on b, so it is calculated once per curve. The rest
+ * is done with the exact same double arithmetic in every code path, so
+ * the SIMD versions give the same ramps as the plain C one.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <strings.h>
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include "include/common.h"
+#include "include/gamma.h"
+
+
+static void ramp_fill_plain(const struct gamma_curve *curve, double brightness,
+                            unsigned short *ramp);
+#ifdef HAVE_X86_SIMD
+static void ramp_fill_sse2(const struct gamma_curve *curve, double brightness,
+                           unsigned short *ramp);
+static void ramp_fill_avx2(const struct gamma_curve *curve, double brightness,
+                           unsigned short *ramp);
+#endif
+
+
+bool gamma_curve_init(struct gamma_curve *curve, int size, float gamma)
+{
+    curve->size = size;
+    /*
+     * The hardware color lookup table has a number of significant
+     * bits equal to ffs(size) - 1; compute all values so that
+     * they are in the range [0,size) then shift the values so
+     * that they occupy the MSBs of the 16-bit X Color.
+     */
+    curve->shift = 16 - (ffs(size) - 1);
+    curve->exponent = 1.0 / (gamma == 0.0 ? 1.0 : gamma);
+    curve->values = NULL;
+
+    /* The fastest the CPU can do, found out once rather than per ramp */
+    if (!gamma_curve_set_kernel(curve, GAMMA_KERNEL_AVX2)
+        && !gamma_curve_set_kernel(curve, GAMMA_KERNEL_SSE2))
+        gamma_curve_set_kernel(curve, GAMMA_KERNEL_PLAIN);
+
+    /* x^1 is x, no need to store that */
+    if (curve->exponent == 1.0)
+        return true;
+
+    curve->values = (double *)malloc(size * sizeof(double));
+    if (!curve->values)
+        return false;
+    for (int i = 0; i < size; i++)
+        curve->values[i] = pow((double)i / (double)(size - 1), curve->exponent);
+    return true;
+}
+
+void gamma_curve_free(struct gamma_curve *curve)
+{
+    free(curve->values);
+    curve->values = NULL;
+}
+
+bool gamma_curve_set_kernel(struct gamma_curve *curve, enum gamma_kernel kernel)
+{
+    switch (kernel) {
+    case GAMMA_KERNEL_PLAIN:
+        curve->fill = ramp_fill_plain;
+        return true;
+#ifdef HAVE_X86_SIMD
+    case GAMMA_KERNEL_SSE2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("sse2"))
+            return false;
+        curve->fill = ramp_fill_sse2;
+        return true;
+    case GAMMA_KERNEL_AVX2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2"))
+            return false;
+        curve->fill = ramp_fill_avx2;
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+static void ramp_fill_scalar(const struct gamma_curve *curve, double brightness,
+                             unsigned short *ramp, int start)
+{
+    double top = (double)(curve->size - 1);
+
+    for (int i = start; i < curve->size; i++) {
+        double v = curve->values ? curve->values[i] : (double)i / top;
+        unsigned short entry = fmin(v * brightness, 1.0) * top;
+        ramp[i] = entry << curve->shift;
+    }
+}
+
+static void ramp_fill_plain(const struct gamma_curve *curve, double brightness,
+                            unsigned short *ramp)
+{
+    ramp_fill_scalar(curve, brightness, ramp, 0);
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * Shift eight 32-bit entries into place and keep the low 16 bits of each,
+ * like the assignment to an unsigned short does. packs_epi32 saturates,
+ * so sign extend the low halves first to make it a plain truncation.
+ */
+#define PACK_RAMP(lo, hi, count) \
+    _mm_packs_epi32(_mm_srai_epi32(_mm_sll_epi32((lo), (count)), 16), \
+                    _mm_srai_epi32(_mm_sll_epi32((hi), (count)), 16))
+
+__attribute__((target("sse2")))
+static void ramp_fill_sse2(const struct gamma_curve *curve, double brightness,
+                           unsigned short *ramp)
+{
+    const __m128d b = _mm_set1_pd(brightness);
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128d top = _mm_set1_pd((double)(curve->size - 1));
+    const __m128i count = _mm_cvtsi32_si128(curve->shift + 16);
+    __m128i q[4];
+    int i;
+
+    for (i = 0; i + 8 <= curve->size; i += 8) {
+        for (int j = 0; j < 4; j++) {
+            int k = i + 2 * j;
+            __m128d v;
+            if (curve->values)
+                v = _mm_loadu_pd(curve->values + k);
+            else
+                v = _mm_div_pd(_mm_set_pd(k + 1, k), top);
+            /* min_pd returns its second operand for NaN, like fmin() */
+            v = _mm_mul_pd(_mm_min_pd(_mm_mul_pd(v, b), one), top);
+            q[j] = _mm_cvttpd_epi32(v);
+        }
+        _mm_storeu_si128((__m128i *)(ramp + i),
+                         PACK_RAMP(_mm_unpacklo_epi64(q[0], q[1]),
+                                   _mm_unpacklo_epi64(q[2], q[3]), count));
+    }
+    ramp_fill_scalar(curve, brightness, ramp, i);
+}
+
+__attribute__((target("avx2")))
+static void ramp_fill_avx2(const struct gamma_curve *curve, double brightness,
+                           unsigned short *ramp)
+{
+    const __m256d b = _mm256_set1_pd(brightness);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d top = _mm256_set1_pd((double)(curve->size - 1));
+    const __m128i count = _mm_cvtsi32_si128(curve->shift + 16);
+    __m128i q[2];
+    int i;
+
+    for (i = 0; i + 8 <= curve->size; i += 8) {
+        for (int j = 0; j < 2; j++) {
+            int k = i + 4 * j;
+            __m256d v;
+            if (curve->values)
+                v = _mm256_loadu_pd(curve->values + k);
+            else
+                v = _mm256_div_pd(_mm256_set_pd(k + 3, k + 2, k + 1, k), top);
+            v = _mm256_mul_pd(_mm256_min_pd(_mm256_mul_pd(v, b), one), top);
+            q[j] = _mm256_cvttpd_epi32(v);
+        }
+        _mm_storeu_si128((__m128i *)(ramp + i), PACK_RAMP(q[0], q[1], count));
+    }
+    ramp_fill_scalar(curve, brightness, ramp, i);
+}
+#endif /* HAVE_X86_SIMD */
+
+void gamma_ramp_fill(const struct gamma_curve *curve, uint32_t level, unsigned short *ramp)
+{
+    float brightness = level / 100.0;
+
+    if (curve->exponent == 1.0 && brightness == 1.0) {
+        for (int i = 0; i < curve->size; i++)
+            ramp[i] = i << curve->shift;
+        return;
+    }
+
+    curve->fill(curve, brightness, ramp);
+}
+
+/* FNV-1a over the three channels, cheap enough to run on every poll */
+uint64_t gamma_ramp_fingerprint(const unsigned short *red, const unsigned short *green,
+                                const unsigned short *blue, int size)
+{
+    const unsigned short *channels[3] = { red, green, blue };
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (int c = 0; c < 3; c++) {
+        for (int i = 0; i < size; i++) {
+            hash = (hash ^ channels[c][i]) * 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
@@ -20,25 +20,32 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include "method.h"
+
 struct dimensions {
     int x, y, width, height;
 };
 
-enum method {
-    NONE = 0,
-    BACKLIGHT = 1,
-    GAMMA = 2
-};
 
 void brightness_init(Display *display, bool set_verbose, const char *exclude[]);
+bool brightness_init_oneshot(Display *display, bool set_verbose, const char *exclude[],
+                             const char *output, enum method method);
 void brightness_reinit(void);
+XRRScreenResources *brightness_get_screen(void);
+void brightness_screen_changed(void);
 bool brightness_is_changed(void);
+int brightness_get_fds(int *fds, int max);
+int brightness_get_timeout(void);
+void brightness_flush(void);
+void brightness_property_changed(RROutput output, Atom property);
 float brightness_get_level(int monitor);
 void brightness_set_level(float level);
 void brightness_set_level_rel(float delta_level);
 void brightness_tick(void);
 const char *brightness_get_monitor_name(void);
+const char *brightness_get_output_name(int monitor);
 void brightness_set_monitor_rel(int delta_monitor);
+bool brightness_set_monitor(const char *name);
 int brightness_get_current_monitor(void);
 RRCrtc brightness_get_crtc(void);
 void brightness_ready(void);
@@ -49,4 +56,5 @@ int brightness_get_monitor_count(void);
 struct dimensions brightness_get_dimensions(int monitor);
 bool brightness_set_method(enum method method);
 enum method brightness_get_method(void);
+bool brightness_parse_method(const char *name, enum method *method);
 bool brightness_has_method(enum method method);
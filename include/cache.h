@@ -0,0 +1,55 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/* include/cache.h: remembering what outputs can do between runs */
+
+#ifndef WMBRIGHT_CACHE_H
+#define WMBRIGHT_CACHE_H
+
+/* What we know about a monitor, identified by the hash of its EDID */
+struct output_caps {
+    uint64_t edid_hash;
+    uint32_t backlight_min, backlight_max;
+    int32_t gamma_size;
+    uint8_t has_backlight;
+    uint8_t method;                 /* Last method used, an enum method */
+    uint8_t pad[2];
+};
+
+/* Hash of an EDID blob, never 0 */
+uint64_t cache_hash(const unsigned char *data, int length);
+
+/* Read the cache file, if there is one */
+void cache_load(bool verbose);
+
+/* Find the entry for a monitor, or NULL */
+const struct output_caps *cache_lookup(uint64_t edid_hash);
+
+/* Add or replace the entry for a monitor */
+void cache_store(const struct output_caps *caps);
+
+/* Forget about a monitor, its entry turned out to be wrong */
+void cache_forget(uint64_t edid_hash);
+
+/* Remember the method last used on a monitor */
+void cache_set_method(uint64_t edid_hash, int method);
+
+/* Write the cache file if anything changed */
+void cache_save(void);
+
+#endif /* WMBRIGHT_CACHE_H */
@@ -32,12 +32,27 @@ extern struct _Config {
     unsigned int mousewheel : 1;      /* mousewheel enabled? */
     unsigned int scrolltext : 1;      /* scroll channel names? */
     unsigned int mmkeys     : 1;      /* grab multimedia keys for volume control */
+    unsigned int poll       : 1;      /* poll for brightness changes made by others */
+    unsigned int ddc        : 1;      /* look for monitors controllable through DDC/CI */
+    unsigned int control    : 1;      /* listen for commands on a socket */
+    unsigned int daemon     : 1;      /* no dockapp or OSD, only keys, socket and signals */
+    unsigned int shm        : 1;      /* publish the state in shared memory */
+    unsigned int stream     : 1;      /* print the state to stdout as it changes */
 
     unsigned int wheel_button_up;     /* up button */
     unsigned int wheel_button_down;   /* down button */
 
     float        scrollstep;          /* scroll mouse step adjustment */
+    unsigned int gamma_rate;          /* max gamma updates per second, 0 = refresh rate */
+    unsigned int settle_time;         /* ms without RandR events before reconfiguring */
     char        *osd_color;           /* osd color */
+    char        *sysfs_root;          /* where to look for backlight devices, NULL = /sys/class/backlight */
+    char        *ddc_root;            /* where to look for i2c buses, NULL = /dev */
+    char        *control_socket;      /* where to listen for commands, NULL = in $XDG_RUNTIME_DIR */
+
+    char        *set_level;           /* set this level and exit, NULL = run the dockapp */
+    char        *set_output;          /* output to set the level of, NULL = all */
+    char        *set_method;          /* method to set the level with, NULL = current */
 
     char        *exclude_output[EXCLUDE_MAX_COUNT + 1];     /* Outputs to exclude from GUI's list */
 } config;
@@ -0,0 +1,46 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/* include/control.h: remote control through a UNIX socket */
+
+#ifndef WMBRIGHT_CONTROL_H
+#define WMBRIGHT_CONTROL_H
+
+/* Most clients connected at once */
+#define CONTROL_MAX_CLIENTS 16
+
+/* What a batch of commands changed, for the UI to catch up with */
+#define CONTROL_LEVEL  1
+#define CONTROL_OUTPUT 2
+#define CONTROL_METHOD 4
+
+/* Start listening on path, or on a socket in $XDG_RUNTIME_DIR named
+   after the display if path is NULL */
+bool control_init(const char *path, const char *display_name, bool verbose);
+
+/* File descriptors to wait on, the socket and its clients */
+int control_get_fds(int *fds, int max);
+
+/* Accept clients and run the commands they sent, without blocking.
+   Returns CONTROL_ flags telling what changed. */
+int control_process(void);
+
+/* Stop listening and remove the socket */
+void control_close(void);
+
+#endif /* WMBRIGHT_CONTROL_H */
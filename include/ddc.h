@@ -0,0 +1,63 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/* include/ddc.h: backlight of external monitors through DDC/CI */
+
+#ifndef WMBRIGHT_DDC_H
+#define WMBRIGHT_DDC_H
+
+#define DDC_DEFAULT_ROOT "/dev"
+
+struct ddc_bus;
+
+/* Look for monitors on the i2c buses under root, in the background */
+void ddc_init(const char *root, bool poll, bool verbose);
+
+/* Look again which monitors are on the buses, after outputs changed */
+void ddc_rescan(void);
+
+/* The bus of the monitor with the given EDID hash, or NULL */
+struct ddc_bus *ddc_find(uint64_t edid_hash);
+
+/* Highest level the monitor accepts, the lowest is always 0 */
+uint32_t ddc_get_max(struct ddc_bus *bus);
+
+/* The last level read from or written to the monitor, or the one on
+   its way there */
+uint32_t ddc_get_level(struct ddc_bus *bus);
+
+/* Queue a new level, replacing any level still waiting to be written */
+void ddc_set_level(struct ddc_bus *bus, uint32_t level);
+
+/* True while some bus is still being probed */
+bool ddc_is_probing(void);
+
+/* File descriptor that becomes readable when something happened on a
+   bus, -1 if there are no buses */
+int ddc_get_fd(void);
+
+/* True, once, if anything happened on any bus since last asked */
+bool ddc_check_events(void);
+
+/* True, once, if a bus was found or its level changed since last asked */
+bool ddc_take_changed(struct ddc_bus *bus);
+
+/* Write whatever is still queued and stop */
+void ddc_flush(void);
+
+#endif /* WMBRIGHT_DDC_H */
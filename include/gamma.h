@@ -0,0 +1,57 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/* include/gamma.h: generation of gamma ramps */
+
+#ifndef WMBRIGHT_GAMMA_H
+#define WMBRIGHT_GAMMA_H
+
+/* The ways a ramp can be filled, they all give the same result */
+enum gamma_kernel {
+    GAMMA_KERNEL_PLAIN,
+    GAMMA_KERNEL_SSE2,
+    GAMMA_KERNEL_AVX2
+};
+
+/* The normalised power curve of one colour channel */
+struct gamma_curve {
+    int size;                       /* Number of entries in the ramp */
+    int shift;                      /* Shift to the MSBs of a 16-bit value */
+    float exponent;                 /* 1 / gamma */
+    double *values;                 /* (i / (size - 1)) ^ exponent, NULL if linear */
+    void (*fill)(const struct gamma_curve *curve, double brightness, unsigned short *ramp);
+};
+
+/* Calculate the curve for a channel with the given gamma */
+bool gamma_curve_init(struct gamma_curve *curve, int size, float gamma);
+
+/* Release memory associated with a curve */
+void gamma_curve_free(struct gamma_curve *curve);
+
+/* Fill ramps of the curve a given way instead of the fastest one.
+   Returns false if the CPU can't do it. */
+bool gamma_curve_set_kernel(struct gamma_curve *curve, enum gamma_kernel kernel);
+
+/* Fill a ramp with the curve scaled to a brightness level in 0..100 */
+void gamma_ramp_fill(const struct gamma_curve *curve, uint32_t level, unsigned short *ramp);
+
+/* Hash of a whole ramp, for telling ramps apart without keeping them */
+uint64_t gamma_ramp_fingerprint(const unsigned short *red, const unsigned short *green,
+                                const unsigned short *blue, int size);
+
+#endif /* WMBRIGHT_GAMMA_H */
@@ -0,0 +1,38 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/* include/method.h: the ways of controlling the brightness of a monitor */
+
+#ifndef WMBRIGHT_METHOD_H
+#define WMBRIGHT_METHOD_H
+
+enum method {
+    NONE = 0,
+    BACKLIGHT = 1,
+    GAMMA = 2,
+    SYSFS = 3,
+    DDC = 4
+};
+
+#define METHOD_COUNT 5
+
+/* The method to use on a monitor: the preferred one if the monitor
+   supports it, else the best one it supports, NONE if there is none */
+enum method method_pick(const bool supported[METHOD_COUNT], enum method preferred);
+
+#endif /* WMBRIGHT_METHOD_H */
@@ -28,7 +28,11 @@ extern struct multimedia_keys {
     KeyCode brightness_down;
 } mmkeys;
 
-/* Grab the multimedia keys */
+/* Held with the brightness keys for smaller or bigger steps */
+#define MMKEY_FINE_MASK   ShiftMask
+#define MMKEY_COARSE_MASK ControlMask
+
+/* Grab the multimedia keys, and ask for key repeats to be told apart */
 void mmkey_install(Display *display);
 
 #endif /* WMBRIGHT_MMKEYS_H */
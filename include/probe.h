@@ -0,0 +1,60 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/* include/probe.h: finding out what the outputs can do */
+
+#ifndef WMBRIGHT_PROBE_H
+#define WMBRIGHT_PROBE_H
+
+/* How much to find out about an output in probe_details() */
+#define PROBE_NONE 0
+#define PROBE_CRTC 1                /* Only position, size and mode */
+#define PROBE_ALL  2
+
+struct output_probe {
+    RROutput output;
+    RRCrtc crtc;
+    char name[17];
+    int connection;
+    int nclone;
+    RROutput *clones;
+    int wanted;                     /* One of the PROBE_ values */
+
+    /* Filled in by probe_details() */
+    bool has_backlight;
+    Atom backlight_atom;
+    uint32_t backlight_min, backlight_max, backlight_level;
+    int gamma_size;
+    uint64_t edid_hash;             /* 0 if the monitor has no EDID */
+    bool cached;                    /* The above came from the cache */
+    int method;                     /* Method last used, -1 if not known */
+    struct dimensions dim;
+    RRMode mode;
+};
+
+/* Get the basic information about all outputs of the screen */
+struct output_probe *probe_outputs(Display *display, XRRScreenResources *screen);
+
+/* Find out what the outputs marked as wanted can do */
+void probe_details(Display *display, XRRScreenResources *screen,
+                   struct output_probe *probes, int count);
+
+/* Release memory associated with the probes */
+void probe_free(struct output_probe *probes, int count);
+
+#endif /* WMBRIGHT_PROBE_H */
@@ -0,0 +1,35 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/* include/state.h: publish the brightness state in shared memory */
+
+#ifndef WMBRIGHT_STATE_H
+#define WMBRIGHT_STATE_H
+
+#include "wmbright_state.h"
+
+/* Create the segment for the display */
+bool state_init(const char *display_name, bool verbose);
+
+/* Update the segment if anything changed since last time */
+void state_publish(void);
+
+/* Remove the segment */
+void state_close(void);
+
+#endif /* WMBRIGHT_STATE_H */
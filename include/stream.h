@@ -0,0 +1,32 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/* include/stream.h: print the state of the outputs to stdout as it changes */
+
+#ifndef WMBRIGHT_STREAM_H
+#define WMBRIGHT_STREAM_H
+
+/* Get ready to print, the first update prints every output */
+void stream_init(void);
+
+/* Print the outputs that changed since last time, unless that was less
+   than a frame ago. Then next is set to when to try again, 0 if there
+   is nothing to wait for. Returns false if stdout can't be written to. */
+bool stream_update(double now, double *next);
+
+#endif /* WMBRIGHT_STREAM_H */
@@ -0,0 +1,58 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/* include/sysfs.h: backlight control through /sys/class/backlight */
+
+#ifndef WMBRIGHT_SYSFS_H
+#define WMBRIGHT_SYSFS_H
+
+#define SYSFS_DEFAULT_ROOT "/sys/class/backlight"
+
+struct sysfs_backlight;
+
+/* Find the backlight devices under root and start watching them */
+void sysfs_init(const char *root, bool verbose);
+
+/* The device controlling the backlight of an output, or NULL */
+struct sysfs_backlight *sysfs_find(const char *output_name);
+
+/* Highest level the device accepts, the lowest is always 0 */
+uint32_t sysfs_get_max(struct sysfs_backlight *dev);
+
+/* Read the level the hardware is at now */
+bool sysfs_get_level(struct sysfs_backlight *dev, uint32_t *level);
+
+/* Ask for a new level */
+bool sysfs_set_level(struct sysfs_backlight *dev, uint32_t level);
+
+/* File descriptor that becomes readable when there are notifications,
+   -1 if there are no devices */
+int sysfs_get_fd(void);
+
+/* Look for notifications without blocking. Returns true if a device
+   changed; sysfs_take_changed() tells which. */
+bool sysfs_check_events(void);
+
+/* True, once, if the device changed since last asked */
+bool sysfs_take_changed(struct sysfs_backlight *dev);
+
+/* Read the level after a change. Returns false if it is only one of our
+   own writes showing up, true with the level if someone else set it. */
+bool sysfs_read_change(struct sysfs_backlight *dev, uint32_t *level);
+
+#endif /* WMBRIGHT_SYSFS_H */
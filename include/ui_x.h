@@ -34,7 +34,7 @@ void ui_update(void);
 void redraw_window(void);
 
 int blit_string(const char *text);
-void scroll_text(int x, int y, int width, int chars, bool reset);
+bool scroll_text(int x, int y, int width, int chars, bool reset);
 void set_cursor(int type);
 void knob_turn(float delta);
 
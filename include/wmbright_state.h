@@ -0,0 +1,95 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * include/wmbright_state.h: brightness state shared with other programs
+ *
+ * wmbright keeps the state of every output in a POSIX shared memory
+ * segment named /wmbright-<display>, e.g. /wmbright-:0. Status bars can
+ * map it read-only and look at it as often as they like: no system
+ * calls, no X traffic. The segment is guarded by a seqlock, readers copy
+ * it out with wmbright_state_read(), which retries if the copy was torn
+ * by a concurrent update.
+ *
+ * This header only needs the C library, so that readers can include it
+ * on its own.
+ */
+
+#ifndef WMBRIGHT_SHARED_STATE_H
+#define WMBRIGHT_SHARED_STATE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define WMBRIGHT_STATE_MAGIC   0x5342776d   /* "mwBS" */
+#define WMBRIGHT_STATE_VERSION 1
+
+/* The name of the segment is this followed by the display name, with
+   any '/' in it replaced by '_' */
+#define WMBRIGHT_STATE_PREFIX  "/wmbright-"
+
+#define WMBRIGHT_STATE_MAX_OUTPUTS 16
+
+struct wmbright_output_state {
+    char name[32];                  /* Output name, "ALL" for the first one */
+    char method[16];                /* "Backlight", "Gamma", "Sysfs", "DDC" or "None" */
+    float level;                    /* Normalised level, 0.0 to 1.0 */
+    uint32_t percent;               /* The level as shown by wmbright */
+};
+
+struct wmbright_state {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;              /* Odd while being written */
+    uint32_t generation;            /* Increased whenever something changed */
+    uint32_t count;                 /* Outputs in use, ALL included */
+    uint32_t selected;              /* Index of the output selected in wmbright */
+    struct wmbright_output_state outputs[WMBRIGHT_STATE_MAX_OUTPUTS];
+};
+
+/* Copy a consistent snapshot of the segment. Returns 0 if it isn't a
+   wmbright state of a known version, or if it never settles, which only
+   happens if wmbright died while updating it. */
+static inline int wmbright_state_read(const struct wmbright_state *state,
+                                      struct wmbright_state *copy)
+{
+    for (int tries = 0; tries < 10000; tries++) {
+        uint32_t before = __atomic_load_n(&state->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1)
+            continue;
+        memcpy(copy, (const void *)state, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&state->sequence, __ATOMIC_RELAXED) != before)
+            continue;
+
+        if (copy->magic != WMBRIGHT_STATE_MAGIC || copy->version != WMBRIGHT_STATE_VERSION)
+            return 0;
+        if (copy->count > WMBRIGHT_STATE_MAX_OUTPUTS)
+            copy->count = WMBRIGHT_STATE_MAX_OUTPUTS;
+        return 1;
+    }
+    return 0;
+}
+
+/* Cheap check for changes since a snapshot was taken */
+static inline uint32_t wmbright_state_generation(const struct wmbright_state *state)
+{
+    return __atomic_load_n(&state->generation, __ATOMIC_ACQUIRE);
+}
+
+#endif /* WMBRIGHT_SHARED_STATE_H */
@@ -0,0 +1,46 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/* include/xinput.h: pointer input through XInput 2 */
+
+#ifndef WMBRIGHT_XINPUT_H
+#define WMBRIGHT_XINPUT_H
+
+/* Check for XInput 2, returns false if it can't be used */
+bool xinput_init(Display *display, bool verbose);
+
+/* Grab the pointer inside the window and start reading raw motion.
+   Returns false if that can't be done, and warping has to do. */
+bool xinput_drag_start(Window window, Time time);
+
+/* Stop reading raw motion and let go of the pointer */
+void xinput_drag_stop(Time time);
+
+/* Start or stop listening for smooth scrolling, as the pointer enters
+   or leaves the dockapp */
+void xinput_hover(bool inside);
+
+/* Get the vertical movement, in pixels, and the scrolling, in wheel
+   clicks, from a raw motion event. Returns false for other events. */
+bool xinput_get_motion(XEvent *event, double *dy, double *scroll);
+
+/* Whether a wheel button press is one made up from smooth scrolling
+   that was already taken into account */
+bool xinput_is_emulated(Time time);
+
+#endif /* WMBRIGHT_XINPUT_H */
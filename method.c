@@ -0,0 +1,42 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * method.c: choosing how to control the brightness of a monitor
+ */
+
+#include <sys/types.h>
+
+#include "include/common.h"
+#include "include/method.h"
+
+
+/* Best first: a real backlight, through RandR or the kernel, then the
+   monitor's own setting, and gamma, which only darkens the picture, last */
+static const enum method method_order[] = { BACKLIGHT, SYSFS, DDC, GAMMA };
+
+enum method method_pick(const bool supported[METHOD_COUNT], enum method preferred)
+{
+    if (preferred != NONE && supported[preferred])
+        return preferred;
+    for (int i = 0; i < lengthof(method_order); i++) {
+        if (supported[method_order[i]])
+            return method_order[i];
+    }
+    return NONE;
+}
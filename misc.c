@@ -30,7 +30,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/time.h>
+#include <time.h>
 
 #include "include/common.h"
 #include "include/misc.h"
@@ -45,15 +45,16 @@ typedef struct {
 
 MRegion mr[16];
 
+/* Seconds on the monotonic clock, only good for measuring intervals */
 double get_current_time(void)
 {
-    struct timeval tv;
+    struct timespec ts;
     double t;
 
-    gettimeofday(&tv, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    t = (double)tv.tv_sec;
-    t += (double)tv.tv_usec / 1.0e6;
+    t = (double)ts.tv_sec;
+    t += (double)ts.tv_nsec / 1.0e9;
 
     return t;
 }
@@ -25,6 +25,7 @@
 
 #include <X11/Xlib.h>
 #include <X11/Xproto.h>
+#include <X11/XKBlib.h>
 #include <X11/keysym.h>
 #include <X11/XF86keysym.h>
 
@@ -36,14 +37,20 @@
 /* The global configuration */
 struct multimedia_keys mmkeys;
 
-/* The list of keys we're interrested in */
+/* The list of keys we're interrested in, with the modifiers for the
+   fine and coarse steps */
 static const struct {
     KeySym  symbol;
+    unsigned int modifier;
     KeyCode *store;
     const char *name;
 } key_list[] = {
-    { XF86XK_MonBrightnessUp, &mmkeys.brightness_up, "BrightnessUp" },
-    { XF86XK_MonBrightnessDown, &mmkeys.brightness_down, "BrightnessDown" }
+    { XF86XK_MonBrightnessUp, 0, &mmkeys.brightness_up, "BrightnessUp" },
+    { XF86XK_MonBrightnessDown, 0, &mmkeys.brightness_down, "BrightnessDown" },
+    { XF86XK_MonBrightnessUp, MMKEY_FINE_MASK, &mmkeys.brightness_up, "Shift+BrightnessUp" },
+    { XF86XK_MonBrightnessDown, MMKEY_FINE_MASK, &mmkeys.brightness_down, "Shift+BrightnessDown" },
+    { XF86XK_MonBrightnessUp, MMKEY_COARSE_MASK, &mmkeys.brightness_up, "Control+BrightnessUp" },
+    { XF86XK_MonBrightnessDown, MMKEY_COARSE_MASK, &mmkeys.brightness_down, "Control+BrightnessDown" }
 };
 
 /* The modifiers that should not have impact on the key grabbed */
@@ -87,6 +94,7 @@ void mmkey_install(Display *display)
     modifier_masks mod_masks;
     struct mmkey_track install_info;
     Window root_window;
+    Bool detectable;
     int i, j;
 
     mmkey_build_modifier_list(display, &mod_masks);
@@ -109,7 +117,7 @@ void mmkey_install(Display *display)
         install_info.request[i].displayed = False;
         for (j = 0; j < mod_masks.count; j++) {
             install_info.request[i].serial[j] = NextRequest(display);
-            XGrabKey(display, key, mod_masks.list[j], root_window,
+            XGrabKey(display, key, mod_masks.list[j] | key_list[i].modifier, root_window,
                      False, GrabModeAsync, GrabModeAsync);
         }
         if (config.verbose)
@@ -120,6 +128,13 @@ void mmkey_install(Display *display)
     XSync(display, False);
     XSetErrorHandler(install_info.previous_handler);
     track_install = NULL;
+
+    /* Without this, a held key looks like it is released before every
+       repeat, and there is no telling repeats from taps */
+    detectable = False;
+    XkbSetDetectableAutoRepeat(display, True, &detectable);
+    if (config.verbose)
+        printf("Detectable key repeat: %s\n", detectable ? "yes" : "no");
 }
 
 /*
@@ -0,0 +1,277 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * probe.c: finding out what the outputs can do
+ *
+ * Done through XCB on the Xlib connection, so that all requests of a
+ * stage can be sent before waiting for the first reply. That makes the
+ * startup cost a couple of round trips instead of a few per output and
+ * property, which is noticeable on remote displays.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
+#include <X11/extensions/Xrandr.h>
+#include <xcb/randr.h>
+
+#include "include/common.h"
+#include "include/brightness.h"
+#include "include/probe.h"
+#include "include/cache.h"
+
+
+static Atom backlight_atom = None;
+static Atom edid_atom = None;
+static bool atoms_interned = false;
+
+struct output_probe *probe_outputs(Display *display, XRRScreenResources *screen)
+{
+    xcb_connection_t *c = XGetXCBConnection(display);
+    xcb_randr_get_output_info_cookie_t cookies[screen->noutput];
+    xcb_intern_atom_cookie_t atom_cookie, edid_cookie;
+    struct output_probe *probes;
+
+    probes = (struct output_probe *)calloc(screen->noutput, sizeof(struct output_probe));
+
+    /* Make sure our own pending requests are seen first */
+    XFlush(display);
+
+    if (!atoms_interned) {
+        atom_cookie = xcb_intern_atom(c, 1, strlen("Backlight"), "Backlight");
+        edid_cookie = xcb_intern_atom(c, 1, strlen("EDID"), "EDID");
+    }
+    for (int i = 0; i < screen->noutput; i++)
+        cookies[i] = xcb_randr_get_output_info(c, screen->outputs[i], screen->configTimestamp);
+
+    if (!atoms_interned) {
+        atoms_interned = true;
+        xcb_intern_atom_reply_t *r = xcb_intern_atom_reply(c, atom_cookie, NULL);
+        if (r) {
+            backlight_atom = r->atom;
+            free(r);
+        }
+        r = xcb_intern_atom_reply(c, edid_cookie, NULL);
+        if (r) {
+            edid_atom = r->atom;
+            free(r);
+        }
+    }
+    for (int i = 0; i < screen->noutput; i++) {
+        struct output_probe *p = &probes[i];
+        xcb_randr_get_output_info_reply_t *r;
+
+        p->output = screen->outputs[i];
+        r = xcb_randr_get_output_info_reply(c, cookies[i], NULL);
+        if (!r)
+            continue;
+        int len = MIN(xcb_randr_get_output_info_name_length(r), 16);
+        memcpy(p->name, xcb_randr_get_output_info_name(r), len);
+        p->name[len] = '\0';
+        p->crtc = r->crtc;
+        p->connection = r->connection;
+        p->nclone = r->num_clones;
+        if (p->nclone > 0) {
+            xcb_randr_output_t *clones = xcb_randr_get_output_info_clones(r);
+            p->clones = (RROutput *)malloc(p->nclone * sizeof(RROutput));
+            for (int j = 0; j < p->nclone; j++)
+                p->clones[j] = clones[j];
+        }
+        free(r);
+    }
+    return probes;
+}
+
+/* Current backlight level, if the output has one */
+static bool read_backlight_level(struct output_probe *p, xcb_connection_t *c,
+                                 xcb_randr_get_output_property_cookie_t cookie)
+{
+    xcb_randr_get_output_property_reply_t *value;
+    xcb_generic_error_t *error = NULL;
+    bool found = false;
+
+    /* Outputs without a backlight answer with an error */
+    value = xcb_randr_get_output_property_reply(c, cookie, &error);
+    free(error);
+    if (!value || value->type == XCB_ATOM_NONE)
+        goto out;
+
+    if (value->type != XCB_ATOM_INTEGER) {
+        printf("Output has backlight support but it's type is strange: %d\n",
+               (int)value->type);
+    }
+    if (value->format != 32 || value->num_items < 1)
+        goto out;
+    p->backlight_level = *(uint32_t *)xcb_randr_get_output_property_data(value);
+    found = true;
+out:
+    free(value);
+    return found;
+}
+
+/* Valid range of the backlight */
+static void read_backlight_range(struct output_probe *p, xcb_connection_t *c,
+                                 xcb_randr_query_output_property_cookie_t cookie)
+{
+    xcb_randr_query_output_property_reply_t *query;
+    xcb_generic_error_t *error = NULL;
+
+    query = xcb_randr_query_output_property_reply(c, cookie, &error);
+    free(error);
+    if (!query)
+        return;
+    if (!query->range || xcb_randr_query_output_property_valid_values_length(query) != 2) {
+        printf("Output has backlight support but its settings were not understood.");
+    } else {
+        int32_t *range = xcb_randr_query_output_property_valid_values(query);
+        p->backlight_min = range[0];
+        p->backlight_max = range[1];
+        p->backlight_atom = backlight_atom;
+        p->has_backlight = true;
+    }
+    free(query);
+}
+
+/* Identify the monitor by the base block of its EDID, which is also what
+   it answers over DDC. 0 if it has none. */
+static uint64_t read_edid(xcb_connection_t *c, xcb_randr_get_output_property_cookie_t cookie)
+{
+    xcb_randr_get_output_property_reply_t *value;
+    uint64_t hash = 0;
+
+    value = xcb_randr_get_output_property_reply(c, cookie, NULL);
+    if (value && value->format == 8 && value->num_items >= 128)
+        hash = cache_hash(xcb_randr_get_output_property_data(value), 128);
+    free(value);
+    return hash;
+}
+
+/* Take what we know from the cache, if it agrees with what the server says */
+static bool use_cache(struct output_probe *p, bool has_level)
+{
+    const struct output_caps *caps = cache_lookup(p->edid_hash);
+
+    if (!caps)
+        return false;
+    if (caps->has_backlight != has_level
+        || (has_level && (p->backlight_level < caps->backlight_min
+                          || p->backlight_level > caps->backlight_max))) {
+        cache_forget(p->edid_hash);
+        return false;
+    }
+    if (caps->has_backlight) {
+        p->has_backlight = true;
+        p->backlight_atom = backlight_atom;
+        p->backlight_min = caps->backlight_min;
+        p->backlight_max = caps->backlight_max;
+    }
+    p->gamma_size = caps->gamma_size;
+    p->method = caps->method;
+    p->cached = true;
+    return true;
+}
+
+void probe_details(Display *display, XRRScreenResources *screen,
+                   struct output_probe *probes, int count)
+{
+    xcb_connection_t *c = XGetXCBConnection(display);
+    xcb_randr_get_crtc_info_cookie_t crtc_cookies[count];
+    xcb_randr_get_output_property_cookie_t edid_cookies[count];
+    xcb_randr_get_output_property_cookie_t value_cookies[count];
+    xcb_randr_query_output_property_cookie_t query_cookies[count];
+    xcb_randr_get_crtc_gamma_size_cookie_t size_cookies[count];
+    bool has_level[count];
+    bool uncached = false;
+
+    /* Send everything... */
+    for (int i = 0; i < count; i++) {
+        struct output_probe *p = &probes[i];
+        if (p->wanted == PROBE_NONE || p->crtc == 0)
+            continue;
+        crtc_cookies[i] = xcb_randr_get_crtc_info(c, p->crtc, screen->configTimestamp);
+        if (p->wanted != PROBE_ALL)
+            continue;
+        if (edid_atom != None)
+            edid_cookies[i] = xcb_randr_get_output_property(c, p->output, edid_atom,
+                                                            XCB_ATOM_ANY, 0, 256, 0, 0);
+        if (backlight_atom != None)
+            value_cookies[i] = xcb_randr_get_output_property(c, p->output, backlight_atom,
+                                                             XCB_ATOM_ANY, 0, 100, 0, 0);
+    }
+
+    /* ...then collect the replies */
+    for (int i = 0; i < count; i++) {
+        struct output_probe *p = &probes[i];
+        if (p->wanted == PROBE_NONE || p->crtc == 0)
+            continue;
+
+        xcb_randr_get_crtc_info_reply_t *ci = xcb_randr_get_crtc_info_reply(c, crtc_cookies[i], NULL);
+        if (ci) {
+            p->dim = (struct dimensions){ ci->x, ci->y, ci->width, ci->height };
+            p->mode = ci->mode;
+            free(ci);
+        }
+        if (p->wanted != PROBE_ALL)
+            continue;
+
+        p->method = -1;
+        if (edid_atom != None)
+            p->edid_hash = read_edid(c, edid_cookies[i]);
+        has_level[i] = backlight_atom != None && read_backlight_level(p, c, value_cookies[i]);
+        if (!use_cache(p, has_level[i]))
+            uncached = true;
+    }
+    if (!uncached)
+        return;
+
+    /* Monitors we haven't seen before need another round */
+    for (int i = 0; i < count; i++) {
+        struct output_probe *p = &probes[i];
+        if (p->wanted != PROBE_ALL || p->crtc == 0 || p->cached)
+            continue;
+        if (has_level[i])
+            query_cookies[i] = xcb_randr_query_output_property(c, p->output, backlight_atom);
+        size_cookies[i] = xcb_randr_get_crtc_gamma_size(c, p->crtc);
+    }
+    for (int i = 0; i < count; i++) {
+        struct output_probe *p = &probes[i];
+        if (p->wanted != PROBE_ALL || p->crtc == 0 || p->cached)
+            continue;
+        if (has_level[i])
+            read_backlight_range(p, c, query_cookies[i]);
+
+        xcb_randr_get_crtc_gamma_size_reply_t *size;
+        size = xcb_randr_get_crtc_gamma_size_reply(c, size_cookies[i], NULL);
+        if (size) {
+            p->gamma_size = size->size;
+            free(size);
+        }
+    }
+}
+
+void probe_free(struct output_probe *probes, int count)
+{
+    for (int i = 0; i < count; i++)
+        free(probes[i].clones);
+    free(probes);
+}
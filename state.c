@@ -0,0 +1,146 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * state.c: publish the brightness state in shared memory
+ *
+ * See include/wmbright_state.h for the layout. The segment is only written from
+ * the main loop, and only when something actually changed, so readers
+ * can tell from the generation whether there is anything new.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <X11/Xlib.h>
+#include <X11/extensions/Xrandr.h>
+
+#include "include/common.h"
+#include "include/brightness.h"
+#include "include/state.h"
+
+
+static struct wmbright_state *state = NULL;
+static char shm_name[64];
+
+
+bool state_init(const char *display_name, bool verbose)
+{
+    int fd;
+
+    /* One per display, so instances on different seats stay apart */
+    snprintf(shm_name, sizeof(shm_name), "%s%s", WMBRIGHT_STATE_PREFIX, display_name);
+    for (char *p = shm_name + 1; *p; p++) {
+        if (*p == '/')
+            *p = '_';
+    }
+
+    fd = shm_open(shm_name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        goto fail;
+    if (ftruncate(fd, sizeof(*state)) < 0) {
+        close(fd);
+        goto fail;
+    }
+    state = mmap(NULL, sizeof(*state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (state == MAP_FAILED) {
+        state = NULL;
+        goto fail;
+    }
+
+    /* Left behind by an earlier instance, or brand new: start over, but
+       keep counting so that readers notice */
+    __atomic_store_n(&state->sequence, state->sequence | 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    state->magic = WMBRIGHT_STATE_MAGIC;
+    state->version = WMBRIGHT_STATE_VERSION;
+    state->count = 0;
+    state->selected = 0;
+    memset(state->outputs, 0, sizeof(state->outputs));
+    __atomic_store_n(&state->sequence, state->sequence + 1, __ATOMIC_RELEASE);
+
+    if (verbose)
+        printf("Publishing state in shared memory %s\n", shm_name);
+    return true;
+
+fail:
+    fprintf(stderr, "wmbright:warning: could not create shared memory %s: %s\n",
+            shm_name, strerror(errno));
+    return false;
+}
+
+/* Fill in an output the way it is now. Returns true if that differs
+   from what was published. */
+static bool fill_output(struct wmbright_output_state *out, int monitor)
+{
+    struct wmbright_output_state now;
+
+    memset(&now, 0, sizeof(now));
+    strncpy(now.name, brightness_get_output_name(monitor), sizeof(now.name) - 1);
+    strncpy(now.method, brightness_get_method_name(monitor), sizeof(now.method) - 1);
+    now.level = brightness_get_level(monitor);
+    now.percent = 100 * now.level;
+    if (!memcmp(&now, out, sizeof(now)))
+        return false;
+    *out = now;
+    return true;
+}
+
+void state_publish(void)
+{
+    struct wmbright_output_state outputs[WMBRIGHT_STATE_MAX_OUTPUTS];
+    uint32_t count;
+    bool changed;
+
+    if (!state)
+        return;
+
+    count = MIN(brightness_get_monitor_count() + 1, WMBRIGHT_STATE_MAX_OUTPUTS);
+    memcpy(outputs, state->outputs, sizeof(outputs));
+    changed = count != state->count
+        || (uint32_t)brightness_get_current_monitor() != state->selected;
+    for (uint32_t i = 0; i < count; i++)
+        changed |= fill_output(&outputs[i], i);
+    if (!changed)
+        return;
+
+    __atomic_store_n(&state->sequence, state->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    state->count = count;
+    state->selected = brightness_get_current_monitor();
+    memcpy(state->outputs, outputs, sizeof(outputs));
+    __atomic_store_n(&state->generation, state->generation + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&state->sequence, state->sequence + 1, __ATOMIC_RELEASE);
+}
+
+void state_close(void)
+{
+    if (!state)
+        return;
+    munmap(state, sizeof(*state));
+    state = NULL;
+    shm_unlink(shm_name);
+}
@@ -0,0 +1,102 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * stream.c: print the state of the outputs to stdout as it changes
+ *
+ * Meant for bar programs reading our output: one line per output that
+ * changed, "<output> <method> <percent>", ALL included. Changes are
+ * picked up whenever the main loop wakes up anyway, nothing is polled for
+ * the reader's sake, and whatever changes within a frame is printed at
+ * once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include <X11/Xlib.h>
+#include <X11/extensions/Xrandr.h>
+
+#include "include/common.h"
+#include "include/brightness.h"
+#include "include/stream.h"
+
+
+/* Shortest time between two batches of records, in seconds */
+#define STREAM_FRAME (1.0 / 60.0)
+
+/* Records the reader has seen, at most this many */
+#define STREAM_MAX_OUTPUTS 16
+
+struct record {
+    char name[32];
+    char method[16];
+    int percent;
+};
+
+static struct record printed[STREAM_MAX_OUTPUTS];
+static int printed_count = 0;
+static double last_time = 0.0;
+
+
+void stream_init(void)
+{
+    /* A reader going away shows up as a write error instead */
+    signal(SIGPIPE, SIG_IGN);
+}
+
+static void get_record(struct record *r, int monitor)
+{
+    memset(r, 0, sizeof(*r));
+    strncpy(r->name, brightness_get_output_name(monitor), sizeof(r->name) - 1);
+    strncpy(r->method, brightness_get_method_name(monitor), sizeof(r->method) - 1);
+    r->percent = 100 * brightness_get_level(monitor);
+}
+
+bool stream_update(double now, double *next)
+{
+    struct record current[STREAM_MAX_OUTPUTS];
+    int count = MIN(brightness_get_monitor_count() + 1, STREAM_MAX_OUTPUTS);
+    bool changed = count != printed_count;
+
+    *next = 0.0;
+    for (int i = 0; i < count; i++) {
+        get_record(&current[i], i);
+        if (!changed && memcmp(&current[i], &printed[i], sizeof(current[i])))
+            changed = true;
+    }
+    if (!changed)
+        return true;
+    if (now < last_time + STREAM_FRAME) {
+        /* Come back when the frame is over, with whatever it is then */
+        *next = last_time + STREAM_FRAME;
+        return true;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (i < printed_count && !memcmp(&current[i], &printed[i], sizeof(current[i])))
+            continue;
+        printf("%s %s %d\n", current[i].name, current[i].method, current[i].percent);
+        printed[i] = current[i];
+    }
+    printed_count = count;
+    last_time = now;
+    return fflush(stdout) == 0 && !ferror(stdout);
+}
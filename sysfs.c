@@ -0,0 +1,322 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * sysfs.c: backlight control through /sys/class/backlight
+ *
+ * Many drivers don't export a Backlight property through RandR but
+ * still have a kernel backlight device. Each device has a brightness
+ * file to write to, and an actual_brightness file that the kernel
+ * notifies on whenever the level changes, whoever changed it. We keep
+ * the files open and watch the latter with inotify, so nothing needs to
+ * be polled.
+ *
+ * Devices bound to a DRM connector (the device link points at something
+ * like card0-eDP-1) belong to that output. Firmware and platform
+ * devices don't say which output they belong to, they are given to the
+ * internal panel. When more than one device fits, the kernel's order of
+ * preference is followed: firmware, then platform, then raw.
+ *
+ * Our own writes are notified too, and while the knob moves the level
+ * read back can be from an older write than the last one. Some drivers
+ * also ramp actual_brightness toward the target. So a level read back
+ * only counts as a change from someone else if it isn't the last level
+ * written and no write was made in the last SYSFS_SETTLE_TIME.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+
+#include "include/common.h"
+#include "include/sysfs.h"
+
+
+struct sysfs_backlight {
+    char name[NAME_MAX + 1];
+    char connector[32];             /* DRM connector, empty if not bound */
+    int type;                       /* One of the TYPE_ values */
+    int brightness_fd;
+    int actual_fd;
+    int watch;
+    uint32_t max;
+    bool changed;
+    uint32_t written;               /* Last level we wrote */
+    uint64_t written_time;          /* When, 0 if never */
+    struct sysfs_backlight *next;
+};
+
+/* How long after our last write the levels read back are still ours, in us */
+#define SYSFS_SETTLE_TIME 500000
+
+/* In the order the kernel recommends them */
+#define TYPE_FIRMWARE 0
+#define TYPE_PLATFORM 1
+#define TYPE_RAW      2
+
+static struct sysfs_backlight *devices = NULL;
+static int inotify_fd = -1;
+static bool verbose = false;
+
+static uint64_t monotonic_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Read a small file into buf, without the trailing newline */
+static bool read_attr(int dirfd, const char *file, char *buf, size_t size)
+{
+    int fd = openat(dirfd, file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+        return false;
+    while (n > 0 && isspace((unsigned char)buf[n - 1]))
+        n--;
+    buf[n] = '\0';
+    return true;
+}
+
+/* Read a number at the start of an open file */
+static bool read_number(int fd, uint32_t *value)
+{
+    char buf[16];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0)
+        return false;
+    buf[n] = '\0';
+    *value = strtoul(buf, NULL, 10);
+    return true;
+}
+
+/* Name of the DRM connector the device link points at, "card0-eDP-1" gives "eDP-1" */
+static void read_connector(int dirfd, char *connector, size_t size)
+{
+    char target[PATH_MAX];
+    ssize_t n = readlinkat(dirfd, "device", target, sizeof(target) - 1);
+
+    connector[0] = '\0';
+    if (n <= 0)
+        return;
+    target[n] = '\0';
+    char *base = strrchr(target, '/');
+    base = base ? base + 1 : target;
+    if (strncmp(base, "card", 4) != 0)
+        return;
+    char *dash = strchr(base, '-');
+    if (dash && dash[1])
+        snprintf(connector, size, "%s", dash + 1);
+}
+
+static struct sysfs_backlight *open_device(int rootfd, const char *name)
+{
+    char buf[32];
+    int dirfd = openat(rootfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0)
+        return NULL;
+
+    struct sysfs_backlight *dev = (struct sysfs_backlight *)calloc(1, sizeof(struct sysfs_backlight));
+    snprintf(dev->name, sizeof(dev->name), "%s", name);
+    dev->brightness_fd = -1;
+    dev->actual_fd = -1;
+    dev->watch = -1;
+    dev->type = TYPE_RAW;
+    if (read_attr(dirfd, "type", buf, sizeof(buf))) {
+        if (!strcmp(buf, "firmware"))
+            dev->type = TYPE_FIRMWARE;
+        else if (!strcmp(buf, "platform"))
+            dev->type = TYPE_PLATFORM;
+    }
+    if (!read_attr(dirfd, "max_brightness", buf, sizeof(buf)) || atoi(buf) <= 0)
+        goto fail;
+    dev->max = strtoul(buf, NULL, 10);
+    read_connector(dirfd, dev->connector, sizeof(dev->connector));
+
+    dev->brightness_fd = openat(dirfd, "brightness", O_WRONLY | O_CLOEXEC);
+    if (dev->brightness_fd < 0) {
+        fprintf(stderr, "wmbright:warning: no write access to backlight device %s, ignored\n", name);
+        goto fail;
+    }
+    dev->actual_fd = openat(dirfd, "actual_brightness", O_RDONLY | O_CLOEXEC);
+    if (dev->actual_fd < 0)
+        goto fail;
+    close(dirfd);
+    return dev;
+
+fail:
+    if (dev->brightness_fd >= 0)
+        close(dev->brightness_fd);
+    free(dev);
+    close(dirfd);
+    return NULL;
+}
+
+void sysfs_init(const char *root, bool set_verbose)
+{
+    DIR *dir;
+    struct dirent *entry;
+
+    verbose = set_verbose;
+    if (!root)
+        root = SYSFS_DEFAULT_ROOT;
+    dir = opendir(root);
+    if (!dir)
+        return;
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        struct sysfs_backlight *dev = open_device(dirfd(dir), entry->d_name);
+        if (!dev)
+            continue;
+        if (inotify_fd >= 0) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s/actual_brightness", root, entry->d_name);
+            dev->watch = inotify_add_watch(inotify_fd, path, IN_MODIFY);
+        }
+        if (verbose)
+            printf("Found backlight device %s, max: %u, connector: %s\n", dev->name,
+                   dev->max, dev->connector[0] ? dev->connector : "none");
+        dev->next = devices;
+        devices = dev;
+    }
+    closedir(dir);
+}
+
+/* Same output name, ignoring dashes: the kernel says eDP-1 where some
+   X drivers say eDP1 */
+static bool same_output(const char *a, const char *b)
+{
+    while (*a || *b) {
+        if (*a == '-') {
+            a++;
+        } else if (*b == '-') {
+            b++;
+        } else if (*a++ != *b++) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_internal(const char *output_name)
+{
+    return !strncmp(output_name, "eDP", 3) || !strncmp(output_name, "LVDS", 4)
+        || !strncmp(output_name, "DSI", 3);
+}
+
+struct sysfs_backlight *sysfs_find(const char *output_name)
+{
+    struct sysfs_backlight *best = NULL;
+
+    for (struct sysfs_backlight *dev = devices; dev; dev = dev->next) {
+        if (dev->connector[0] ? !same_output(dev->connector, output_name)
+            : !is_internal(output_name))
+            continue;
+        /* Between two of a kind, the one known to belong to the output */
+        if (!best || dev->type < best->type
+            || (dev->type == best->type && dev->connector[0] && !best->connector[0]))
+            best = dev;
+    }
+    return best;
+}
+
+uint32_t sysfs_get_max(struct sysfs_backlight *dev)
+{
+    return dev->max;
+}
+
+bool sysfs_get_level(struct sysfs_backlight *dev, uint32_t *level)
+{
+    return read_number(dev->actual_fd, level);
+}
+
+bool sysfs_set_level(struct sysfs_backlight *dev, uint32_t level)
+{
+    char buf[16];
+    int n = snprintf(buf, sizeof(buf), "%u\n", MIN(level, dev->max));
+
+    dev->written = MIN(level, dev->max);
+    dev->written_time = monotonic_usec();
+    if (pwrite(dev->brightness_fd, buf, n, 0) != n) {
+        fprintf(stderr, "wmbright:warning: could not set level of backlight device %s\n", dev->name);
+        return false;
+    }
+    return true;
+}
+
+int sysfs_get_fd(void)
+{
+    return devices ? inotify_fd : -1;
+}
+
+bool sysfs_check_events(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    ssize_t n;
+
+    if (inotify_fd < 0)
+        return false;
+    while ((n = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + n; ) {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            for (struct sysfs_backlight *dev = devices; dev; dev = dev->next) {
+                if (dev->watch == event->wd) {
+                    dev->changed = true;
+                    changed = true;
+                }
+            }
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
+
+bool sysfs_take_changed(struct sysfs_backlight *dev)
+{
+    bool changed = dev->changed;
+    dev->changed = false;
+    return changed;
+}
+
+bool sysfs_read_change(struct sysfs_backlight *dev, uint32_t *level)
+{
+    uint32_t current;
+
+    if (!read_number(dev->actual_fd, &current))
+        return false;
+    if (dev->written_time != 0
+        && (current == dev->written || monotonic_usec() < dev->written_time + SYSFS_SETTLE_TIME))
+        return false;
+    *level = current;
+    return true;
+}
@@ -0,0 +1,236 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * tests/ddc_test.c: the DDC/CI method against fake monitors
+ *
+ * Builds i2c-N directories standing in for monitors in a temporary
+ * directory, and checks that the one with brightness control is found
+ * by its EDID, that a burst of levels is coalesced into few writes, that
+ * refused writes are retried, and that the last level is written when
+ * flushing.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "../include/common.h"
+#include "../include/cache.h"
+#include "../include/ddc.h"
+
+
+static char root[] = "/tmp/wmbright-ddc-XXXXXX";
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "ddc_test:%d: %s failed\n", __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+/* Longest a bus thread should take to do anything, in ms */
+#define TIMEOUT 3000
+
+static void write_file(const char *bus, const char *file, const void *content, size_t length)
+{
+    char path[512];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/%s/%s", root, bus, file);
+    fp = fopen(path, "wb");
+    if (!fp) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fwrite(content, 1, length, fp);
+    fclose(fp);
+}
+
+/* The current level in the vcp file of a fake monitor */
+static unsigned int read_level(const char *bus)
+{
+    char path[512];
+    unsigned int current = 0, max = 0;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/%s/vcp", root, bus);
+    fp = fopen(path, "r");
+    if (fp) {
+        if (fscanf(fp, "%u %u", &current, &max) != 2)
+            current = 0;
+        fclose(fp);
+    }
+    return current;
+}
+
+/* Levels written to a fake monitor so far, and the last of them */
+static int count_writes(const char *bus, unsigned int *last)
+{
+    char path[512];
+    unsigned int level;
+    int count = 0;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/%s/log", root, bus);
+    fp = fopen(path, "r");
+    if (!fp)
+        return 0;
+    while (fscanf(fp, "%u", &level) == 1) {
+        *last = level;
+        count++;
+    }
+    fclose(fp);
+    return count;
+}
+
+static void make_edid(unsigned char *edid, unsigned char serial)
+{
+    static const unsigned char header[8] = { 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00 };
+
+    memset(edid, 0, 128);
+    memcpy(edid, header, sizeof(header));
+    edid[12] = serial;
+}
+
+static void add_monitor(const char *bus, unsigned char serial, const char *vcp)
+{
+    unsigned char edid[128];
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s", root, bus);
+    mkdir(path, 0755);
+    make_edid(edid, serial);
+    write_file(bus, "edid", edid, sizeof(edid));
+    if (vcp)
+        write_file(bus, "vcp", vcp, strlen(vcp));
+}
+
+static uint64_t edid_hash(unsigned char serial)
+{
+    unsigned char edid[128];
+
+    make_edid(edid, serial);
+    return cache_hash(edid, sizeof(edid));
+}
+
+static void wait_ms(int ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+/* Wait until the fake monitor is at a level, or give up */
+static bool wait_for_level(const char *bus, unsigned int level)
+{
+    for (int waited = 0; waited < TIMEOUT; waited += 10) {
+        if (read_level(bus) == level)
+            return true;
+        wait_ms(10);
+    }
+    return false;
+}
+
+static int remove_entry(const char *path, __attribute__((unused)) const struct stat *st,
+                        __attribute__((unused)) int flag, __attribute__((unused)) struct FTW *ftw)
+{
+    return remove(path);
+}
+
+int main(void)
+{
+    struct ddc_bus *bus;
+    unsigned int last = 0;
+    int writes;
+
+    if (!mkdtemp(root)) {
+        perror("ddc_test: mkdtemp");
+        return EXIT_FAILURE;
+    }
+    add_monitor("i2c-3", 1, "30 100\n");
+    add_monitor("i2c-4", 2, NULL);          /* No brightness control */
+    add_monitor("spi-1", 3, "10 100\n");    /* Not an i2c bus */
+
+    ddc_init(root, false, false);
+    CHECK(ddc_get_fd() >= 0);
+
+    /* Detection */
+    for (int waited = 0; ddc_is_probing() && waited < TIMEOUT; waited += 10) {
+        struct pollfd fds = { .fd = ddc_get_fd(), .events = POLLIN };
+        poll(&fds, 1, 10);
+        ddc_check_events();
+    }
+    CHECK(!ddc_is_probing());
+    bus = ddc_find(edid_hash(1));
+    CHECK(bus != NULL);
+    CHECK(ddc_find(edid_hash(2)) == NULL);
+    CHECK(ddc_find(edid_hash(3)) == NULL);
+    if (!bus) {
+        nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        return EXIT_FAILURE;
+    }
+    CHECK(ddc_take_changed(bus));
+    CHECK(!ddc_take_changed(bus));
+    CHECK(ddc_get_max(bus) == 100);
+    CHECK(ddc_get_level(bus) == 30);
+
+    /* A burst of levels is coalesced, the last one is reported at once */
+    for (unsigned int level = 31; level <= 70; level++)
+        ddc_set_level(bus, level);
+    CHECK(ddc_get_level(bus) == 70);
+    CHECK(wait_for_level("i2c-3", 70));
+    writes = count_writes("i2c-3", &last);
+    CHECK(writes >= 1 && writes <= 3);
+    CHECK(last == 70);
+    CHECK(ddc_get_level(bus) == 70);
+
+    /* A couple of refused writes are retried */
+    write_file("i2c-3", "nak", "2\n", 2);
+    ddc_set_level(bus, 55);
+    CHECK(wait_for_level("i2c-3", 55));
+    CHECK(ddc_get_level(bus) == 55);
+
+    /* A monitor that keeps refusing stays where it is */
+    write_file("i2c-3", "nak", "100\n", 4);
+    ddc_set_level(bus, 80);
+    for (int waited = 0; !ddc_take_changed(bus) && waited < TIMEOUT; waited += 10)
+        wait_ms(10);
+    CHECK(read_level("i2c-3") == 55);
+    CHECK(ddc_get_level(bus) == 55);
+
+    /* Flushing writes what is still queued */
+    write_file("i2c-3", "nak", "0\n", 2);
+    ddc_set_level(bus, 65);
+    ddc_flush();
+    CHECK(read_level("i2c-3") == 65);
+    CHECK(count_writes("i2c-3", &last) > writes && last == 65);
+
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    if (failures == 0)
+        printf("ddc_test: all checks passed\n");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * tests/gamma_test.c: check gamma_ramp_fill() against the old ramp code
+ *
+ * Every ramp the precalculated curves give must be the same, byte for
+ * byte, as the one brightness_to_gamma() used to calculate with pow()
+ * and fmin() for each entry, whatever way the ramp is filled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+
+#include "../include/common.h"
+#include "../include/gamma.h"
+
+
+/* One channel the way brightness_to_gamma() did it */
+static void old_ramp(int size, float gamma, uint32_t level, unsigned short *ramp)
+{
+    int shift = 16 - (ffs(size) - 1);
+    float brightness = level / 100.0;
+    float exponent;
+
+    if (gamma == 0.0)
+        gamma = 1.0;
+    exponent = 1.0 / gamma;
+
+    for (int i = 0; i < size; i++) {
+        if (exponent == 1.0 && brightness == 1.0)
+            ramp[i] = i;
+        else
+            ramp[i] = fmin(pow((double)i/(double)(size - 1), exponent) * brightness,
+                           1.0) * (double)(size - 1);
+        ramp[i] <<= shift;
+    }
+}
+
+int main(void)
+{
+    static const int sizes[] = { 256, 1024, 4096 };
+    static const float gammas[] = { 1.0, 0.0, 0.5, 0.8, 0.9, 1.1, 1.2, 1.8, 2.2, 3.0 };
+    static const struct {
+        enum gamma_kernel kernel;
+        const char *name;
+    } kernels[] = {
+        { GAMMA_KERNEL_PLAIN, "plain" },
+        { GAMMA_KERNEL_SSE2, "SSE2" },
+        { GAMMA_KERNEL_AVX2, "AVX2" }
+    };
+    unsigned short expected[4096], got[4096];
+    int failures = 0;
+
+    for (int k = 0; k < lengthof(kernels); k++) {
+        int checked = 0;
+
+        for (int s = 0; s < lengthof(sizes); s++) {
+            for (int g = 0; g < lengthof(gammas); g++) {
+                struct gamma_curve curve;
+
+                if (!gamma_curve_init(&curve, sizes[s], gammas[g])) {
+                    fprintf(stderr, "gamma_test: out of memory\n");
+                    return EXIT_FAILURE;
+                }
+                if (!gamma_curve_set_kernel(&curve, kernels[k].kernel)) {
+                    gamma_curve_free(&curve);
+                    continue;
+                }
+                for (uint32_t level = 0; level <= 100; level++) {
+                    old_ramp(sizes[s], gammas[g], level, expected);
+                    gamma_ramp_fill(&curve, level, got);
+                    checked++;
+                    if (memcmp(expected, got, sizes[s] * sizeof(got[0])) != 0) {
+                        fprintf(stderr, "gamma_test: %s ramp differs for size %d, gamma %.1f, level %u\n",
+                                kernels[k].name, sizes[s], gammas[g], level);
+                        failures++;
+                    }
+                }
+                gamma_curve_free(&curve);
+            }
+        }
+        if (checked == 0)
+            printf("gamma_test: %s not supported by this CPU, skipped\n", kernels[k].name);
+        else
+            printf("gamma_test: %s, %d ramps checked\n", kernels[k].name, checked);
+    }
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
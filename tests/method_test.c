@@ -0,0 +1,113 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * tests/method_test.c: which method a monitor ends up with
+ *
+ * Goes through what happens at startup: a monitor is probed, its record
+ * is cached without a method since the user didn't pick one, and on the
+ * next start the record is read back. The method picked then must be
+ * the probed one, not NONE. Also checks falling back when the method in
+ * use goes away.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ftw.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "../include/common.h"
+#include "../include/method.h"
+#include "../include/cache.h"
+
+
+static char root[] = "/tmp/wmbright-method-XXXXXX";
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "method_test:%d: %s failed\n", __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+static int remove_entry(const char *path, __attribute__((unused)) const struct stat *st,
+                        __attribute__((unused)) int flag, __attribute__((unused)) struct FTW *ftw)
+{
+    return remove(path);
+}
+
+int main(void)
+{
+    /* NONE is always "supported", like in new_monitor_data() */
+    bool laptop[METHOD_COUNT] = { true, true, true, true, false };
+    bool sysfs_only[METHOD_COUNT] = { true, false, true, true, false };
+    bool external[METHOD_COUNT] = { true, false, true, false, true };
+    bool nothing[METHOD_COUNT] = { true, false, false, false, false };
+    const struct output_caps *caps;
+
+    if (!mkdtemp(root)) {
+        perror("method_test: mkdtemp");
+        return EXIT_FAILURE;
+    }
+    setenv("XDG_CACHE_HOME", root, 1);
+
+    /* First start: nothing cached, the probe decides */
+    cache_load(false);
+    CHECK(cache_lookup(42) == NULL);
+    CHECK(method_pick(laptop, NONE) == BACKLIGHT);
+    struct output_caps record = { 42, 0, 255, 1024, 1, NONE, { 0 } };
+    cache_store(&record);
+    cache_save();
+
+    /* Second start: the fresh record has no method, keep the probed one */
+    cache_load(false);
+    caps = cache_lookup(42);
+    CHECK(caps != NULL && caps->method == NONE);
+    if (caps) {
+        CHECK(method_pick(laptop, caps->method) == BACKLIGHT);
+        CHECK(method_pick(sysfs_only, caps->method) == SYSFS);
+        CHECK(method_pick(external, caps->method) == DDC);
+    }
+
+    /* A method the user picked is kept while it is there */
+    CHECK(method_pick(laptop, GAMMA) == GAMMA);
+    cache_set_method(42, GAMMA);
+    cache_save();
+    cache_load(false);
+    caps = cache_lookup(42);
+    CHECK(caps && method_pick(laptop, caps->method) == GAMMA);
+
+    /* The DDC/CI bus went away: a real backlight comes before gamma */
+    CHECK(method_pick(laptop, DDC) == BACKLIGHT);
+    CHECK(method_pick(sysfs_only, DDC) == SYSFS);
+    external[DDC] = false;
+    CHECK(method_pick(external, DDC) == GAMMA);
+    CHECK(method_pick(nothing, NONE) == NONE);
+    CHECK(method_pick(nothing, GAMMA) == NONE);
+
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    if (failures == 0)
+        printf("method_test: all checks passed\n");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
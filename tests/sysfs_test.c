@@ -0,0 +1,188 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * tests/sysfs_test.c: the sysfs backlight method against a fake tree
+ *
+ * Builds something that looks like /sys/class/backlight in a temporary
+ * directory and checks which device each output gets, that levels are
+ * written to the brightness file, that changes to actual_brightness
+ * are noticed through inotify and that our own writes showing up there
+ * are not taken for changes.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "../include/common.h"
+#include "../include/sysfs.h"
+
+
+static char root[] = "/tmp/wmbright-sysfs-XXXXXX";
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "sysfs_test:%d: %s failed\n", __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+static void write_file(const char *device, const char *file, const char *content)
+{
+    char path[512];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/%s/%s", root, device, file);
+    fp = fopen(path, "w");
+    if (!fp) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fputs(content, fp);
+    fclose(fp);
+}
+
+static uint32_t read_file(const char *device, const char *file)
+{
+    char path[512], buf[32] = "";
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s/%s/%s", root, device, file);
+    fp = fopen(path, "r");
+    if (!fp || !fgets(buf, sizeof(buf), fp))
+        buf[0] = '\0';
+    if (fp)
+        fclose(fp);
+    return strtoul(buf, NULL, 10);
+}
+
+/* A device with a type, a maximum and, if connector is given, a device
+   link to a DRM connector */
+static void add_device(const char *name, const char *type, const char *max, const char *connector)
+{
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s", root, name);
+    mkdir(path, 0755);
+    write_file(name, "type", type);
+    write_file(name, "max_brightness", max);
+    write_file(name, "brightness", "0\n");
+    write_file(name, "actual_brightness", "0\n");
+    if (connector) {
+        char target[128];
+        snprintf(target, sizeof(target), "../../devices/pci0000:00/drm/card0/%s", connector);
+        snprintf(path, sizeof(path), "%s/%s/device", root, name);
+        symlink(target, path);
+    }
+}
+
+/* Have the "kernel" report a level, and wait for the notification */
+static bool report_level(const char *device, const char *level)
+{
+    struct pollfd fds = { .fd = sysfs_get_fd(), .events = POLLIN };
+
+    write_file(device, "actual_brightness", level);
+    return poll(&fds, 1, 1000) == 1 && sysfs_check_events();
+}
+
+static int remove_entry(const char *path, __attribute__((unused)) const struct stat *st,
+                        __attribute__((unused)) int flag, __attribute__((unused)) struct FTW *ftw)
+{
+    return remove(path);
+}
+
+int main(void)
+{
+    struct sysfs_backlight *dev;
+    uint32_t level;
+
+    if (!mkdtemp(root)) {
+        perror("sysfs_test: mkdtemp");
+        return EXIT_FAILURE;
+    }
+    add_device("intel_backlight", "raw\n", "1000\n", "card0-eDP-1");
+    add_device("acpi_video0", "firmware\n", "15\n", NULL);
+    add_device("dell_backlight", "platform\n", "7\n", NULL);
+    add_device("nv_backlight", "raw\n", "100\n", "card1-DP-2");
+    add_device("broken", "raw\n", "0\n", NULL);
+
+    sysfs_init(root, false);
+    CHECK(sysfs_get_fd() >= 0);
+
+    /* Firmware comes first for the panel, even over a device bound to it */
+    dev = sysfs_find("eDP-1");
+    CHECK(dev && sysfs_get_max(dev) == 15);
+    dev = sysfs_find("LVDS1");
+    CHECK(dev && sysfs_get_max(dev) == 15);
+    /* Bound devices only go to their own output, dashes or not */
+    dev = sysfs_find("DP2");
+    CHECK(dev && sysfs_get_max(dev) == 100);
+    CHECK(sysfs_find("HDMI-1") == NULL);
+
+    /* Levels go to the brightness file, no higher than the maximum */
+    dev = sysfs_find("eDP-1");
+    CHECK(sysfs_set_level(dev, 9));
+    CHECK(read_file("acpi_video0", "brightness") == 9);
+    CHECK(sysfs_set_level(dev, 99));
+    CHECK(read_file("acpi_video0", "brightness") == 15);
+
+    /* The kernel changing actual_brightness is noticed */
+    CHECK(!sysfs_check_events());
+    write_file("acpi_video0", "actual_brightness", "4\n");
+    struct pollfd fds = { .fd = sysfs_get_fd(), .events = POLLIN };
+    CHECK(poll(&fds, 1, 1000) == 1);
+    CHECK(sysfs_check_events());
+    CHECK(sysfs_take_changed(dev));
+    CHECK(!sysfs_take_changed(dev));
+    CHECK(!sysfs_take_changed(sysfs_find("DP-2")));
+    CHECK(sysfs_get_level(dev, &level) && level == 4);
+
+    /* Our own writes are not changes, even an older one read back late */
+    CHECK(sysfs_set_level(dev, 5));
+    CHECK(sysfs_set_level(dev, 9));
+    CHECK(report_level("acpi_video0", "5\n"));
+    CHECK(sysfs_take_changed(dev));
+    CHECK(!sysfs_read_change(dev, &level));
+    CHECK(report_level("acpi_video0", "9\n"));
+    CHECK(sysfs_take_changed(dev));
+    CHECK(!sysfs_read_change(dev, &level));
+
+    /* Once things settled, the last level written is still ours, but
+       anything else is someone else's */
+    struct timespec settle = { 0, 600000000L };
+    nanosleep(&settle, NULL);
+    CHECK(report_level("acpi_video0", "9\n"));
+    CHECK(!sysfs_read_change(dev, &level));
+    CHECK(report_level("acpi_video0", "3\n"));
+    CHECK(sysfs_read_change(dev, &level) && level == 3);
+
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    if (failures == 0)
+        printf("sysfs_test: all checks passed\n");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -61,7 +61,7 @@
 #define LED_HEIGHT 6
 
 struct osd {
-    RRCrtc crtc;
+    char name[17];                  /* Output the OSD belongs to */
     Window win;
     GC gc;
     int width;
@@ -81,6 +81,8 @@ struct dockapp {
     int ctlength;
 
     int osd_count;
+    int osd_height;
+    XFontStruct *osd_font;
     struct osd *osd;
 };
 
@@ -119,6 +121,8 @@ void dockapp_init(Display *x_display)
 
 void redraw_window(void)
 {
+    if (config.daemon)
+        return;
     XCopyArea(display, dockapp.pixmap, iconwin, dockapp.gc,
               0, 0, dockapp.width, dockapp.height, 0, 0);
     XCopyArea(display, dockapp.pixmap, win, dockapp.gc,
@@ -127,6 +131,8 @@ void redraw_window(void)
 
 void ui_update(void)
 {
+    if (config.daemon)
+        return;
     draw_leds();
     draw_knob(brightness_get_level(-1));
     redraw_window();
@@ -135,6 +141,8 @@ void ui_update(void)
 void knob_turn(float delta)
 {
     brightness_set_level_rel(delta);
+    if (config.daemon)
+        return;
     draw_knob(brightness_get_level(-1));
     redraw_window();
 }
@@ -145,6 +153,8 @@ int blit_string(const char *text)
     register int c;
     register int k;
 
+    if (config.daemon)
+        return 0;
     k = 0;
     copy_xpm_area(0, 87, 256, 9, 0, 96);
 
@@ -176,19 +186,23 @@ int blit_string(const char *text)
     return k;
 }
 
-void scroll_text(int x, int y, int width, int chars, bool reset)
+/* Scroll the text one step. Returns true while there is more scrolling
+   to do, that is as long as the text is too long to fit. */
+bool scroll_text(int x, int y, int width, int chars, bool reset)
 {
     static int wait;
     static int pos;
     static int stop;
-    
+
+    if (config.daemon)
+        return false;
     /* no text scrolling at all */
     if (!config.scrolltext || (chars * 7 <= width)) {
         if (!reset)
-            return;
+            return false;
         copy_xpm_area(0, 96, 58, 9, x, y);
         redraw_window();
-        return;
+        return false;
     }
 
     if (reset) {
@@ -199,13 +213,13 @@ void scroll_text(int x, int y, int width, int chars, bool reset)
     }
 
     if (stop) {
-        return;
+        return false;
     }
 
     if (pos < -(dockapp.ctlength)) {
         pos = width;
         wait = 30;
-        return;
+        return true;
     }
     if (wait > 0) {
         wait--;
@@ -223,7 +237,7 @@ void scroll_text(int x, int y, int width, int chars, bool reset)
         copy_xpm_area(abs(pos), 96, width, 9, x, y);
     }
     redraw_window();
-    return;
+    return !stop;
 }
 
 void new_window(char *name, int width, int height)
@@ -265,6 +279,7 @@ void new_window(char *name, int width, int height)
     | ExposureMask \
     | ButtonReleaseMask \
     | PointerMotionMask \
+    | EnterWindowMask \
     | LeaveWindowMask \
     | StructureNotifyMask
 
@@ -320,37 +335,17 @@ void new_window(char *name, int width, int height)
     XMapWindow(display, win);
 }
 
-void destroy_osd()
+static void destroy_osd_window(struct osd *osd)
 {
-    for (int i = 0; i < dockapp.osd_count; i++) {
-        XFreeGC(display, dockapp.osd[i].gc);
-        XDestroyWindow(display, dockapp.osd[i].win);
+    if (osd->win) {
+        XFreeGC(display, osd->gc);
+        XDestroyWindow(display, osd->win);
     }
 }
 
-void new_osd(int height)
+static XFontStruct *load_osd_font(void)
 {
-    Window osdwin;
-    Pixel fg = WhitePixel(display, DefaultScreen(display));
-    Pixel bg = BlackPixel(display, DefaultScreen(display));
-    XGCValues gcval;
-    GC gc;
-    XSizeHints sizehints;
-    XSetWindowAttributes xattributes;
-    int win_layer = 6;
     XFontStruct *fs = NULL;
-    int width;
-    int x;
-    int y;
-    XRRScreenResources *screen = XRRGetScreenResources(display, DefaultRootWindow(display));
-    dockapp.osd_count = brightness_get_monitor_count();
-    dockapp.osd = (struct osd *)malloc(sizeof(struct osd) * dockapp.osd_count);
-    for (int i = 0; i < dockapp.osd_count; i++) {
-        dockapp.osd[i].crtc = screen->crtcs[i];
-        dockapp.osd[i].gc = 0;
-        dockapp.osd[i].win = 0;
-    }
-
 
     /* -sony-fixed-medium-r-normal--24-170-100-100-c-120-iso8859-1
      * -misc-fixed-medium-r-normal--36-*-75-75-c-*-iso8859-* */
@@ -379,57 +374,86 @@ void new_osd(int height)
             }
         }
     }
-    
-    sizehints.flags = USSize | USPosition;
+    return fs;
+}
 
-    for (int i = 0; i < dockapp.osd_count; i++) {
-        dockapp.osd[i].mapped = false;
-        struct dimensions dim = brightness_get_dimensions(i+1);
-        
-        if (dim.width == 0) {
-            dockapp.osd[i].on = false;
-            continue;
-        }
-        width = dim.width - 200;
-        x = dim.x + 100;
-        y = dim.y + dim.height - 120;
-
-        sizehints.x = x;
-        sizehints.y = y;
-        sizehints.width = width;
-        sizehints.height = height;
-        xattributes.save_under = True;
-        xattributes.override_redirect = True;
-        xattributes.cursor = None;
-
-        osdwin = XCreateSimpleWindow(display, DefaultRootWindow(display),
-                                     sizehints.x, sizehints.y, width, height,
-                                     0, fg, bg);
-
-        XSetWMNormalHints(display, osdwin, &sizehints);
-        XChangeWindowAttributes(display, osdwin, CWSaveUnder | CWOverrideRedirect,
-                                &xattributes);
-        char name[5] = "osdx";
-        name[3] = '0' + i;
-        XStoreName(display, osdwin, name);
-        XSelectInput(display, osdwin, ExposureMask);
-        XChangeProperty(display, osdwin, XInternAtom(display, "_WIN_LAYER", False),
-                        XA_CARDINAL, 32, PropModeReplace, (unsigned char *)&win_layer, 1);
-
-        gcval.foreground = get_color(display, config.osd_color);
-        gcval.background = bg;
-        gcval.graphics_exposures = 0;
-        gc = XCreateGC(display, osdwin,
-                       GCForeground | GCBackground | GCGraphicsExposures,
-                       &gcval);
-        XSetFont(display, gc, fs->fid);
-        
-        dockapp.osd[i].win = osdwin;
-        dockapp.osd[i].gc = gc;
-        dockapp.osd[i].width = width;
-        dockapp.osd[i].x = x;
-        dockapp.osd[i].y = y;
+/* Create the OSD window of monitor number i + 1 */
+static void create_osd_window(struct osd *osd, int i)
+{
+    Window osdwin;
+    Pixel fg = WhitePixel(display, DefaultScreen(display));
+    Pixel bg = BlackPixel(display, DefaultScreen(display));
+    XGCValues gcval;
+    GC gc;
+    XSizeHints sizehints;
+    XSetWindowAttributes xattributes;
+    int win_layer = 6;
+    int height = dockapp.osd_height;
+    int width;
+    int x;
+    int y;
+    struct dimensions dim = brightness_get_dimensions(i+1);
+
+    strcpy(osd->name, brightness_get_output_name(i+1));
+    osd->mapped = false;
+    osd->bar = 0;
+    osd->win = 0;
+    osd->gc = 0;
+    osd->x = dim.x + 100;
+    osd->y = dim.y + dim.height - 120;
+    osd->width = dim.width - 200;
+    if (dim.width == 0) {
+        osd->on = false;
+        return;
     }
+    osd->on = true;
+    width = osd->width;
+    x = osd->x;
+    y = osd->y;
+
+    sizehints.flags = USSize | USPosition;
+    sizehints.x = x;
+    sizehints.y = y;
+    sizehints.width = width;
+    sizehints.height = height;
+    xattributes.save_under = True;
+    xattributes.override_redirect = True;
+    xattributes.cursor = None;
+
+    osdwin = XCreateSimpleWindow(display, DefaultRootWindow(display),
+                                 sizehints.x, sizehints.y, width, height,
+                                 0, fg, bg);
+
+    XSetWMNormalHints(display, osdwin, &sizehints);
+    XChangeWindowAttributes(display, osdwin, CWSaveUnder | CWOverrideRedirect,
+                            &xattributes);
+    char name[5] = "osdx";
+    name[3] = '0' + i;
+    XStoreName(display, osdwin, name);
+    XSelectInput(display, osdwin, ExposureMask);
+    XChangeProperty(display, osdwin, XInternAtom(display, "_WIN_LAYER", False),
+                    XA_CARDINAL, 32, PropModeReplace, (unsigned char *)&win_layer, 1);
+
+    gcval.foreground = get_color(display, config.osd_color);
+    gcval.background = bg;
+    gcval.graphics_exposures = 0;
+    gc = XCreateGC(display, osdwin,
+                   GCForeground | GCBackground | GCGraphicsExposures,
+                   &gcval);
+    XSetFont(display, gc, dockapp.osd_font->fid);
+
+    osd->win = osdwin;
+    osd->gc = gc;
+}
+
+void new_osd(int height)
+{
+    dockapp.osd_height = height;
+    dockapp.osd_font = load_osd_font();
+    dockapp.osd_count = brightness_get_monitor_count();
+    dockapp.osd = (struct osd *)malloc(sizeof(struct osd) * dockapp.osd_count);
+    for (int i = 0; i < dockapp.osd_count; i++)
+        create_osd_window(&dockapp.osd[i], i);
 }
 
 void update_osd_by_number(int osd, bool up)
@@ -511,6 +535,8 @@ void map_osd(void)
 
 bool osd_mapped(void)
 {
+    if (!config.osd)
+        return false;
     if (brightness_get_current_monitor() == 0) { 
         for (int i = 0; i < dockapp.osd_count; i++) {
             if (dockapp.osd[i].mapped) {
@@ -527,7 +553,7 @@ void set_cursor(int type)
 {
     static int oldtype;
 
-    if (oldtype == type)
+    if (config.daemon || oldtype == type)
     return;
 
     switch (type) {
@@ -569,6 +595,22 @@ static void draw_leds(void)
             copy_xpm_area(77, 7, 12, 7, 4, 33); /* BL not lit */
     else /* backlight not available */
         copy_xpm_area(77, 14, 12, 7, 4, 33); /* BL dark */
+
+    if (brightness_has_method(SYSFS)) /* kernel backlight exists */
+        if (method == SYSFS)
+            copy_xpm_area(89, 0, 12, 7, 4, 24); /* SY lit */
+        else
+            copy_xpm_area(89, 7, 12, 7, 4, 24); /* SY not lit */
+    else /* kernel backlight not available */
+        copy_xpm_area(89, 14, 12, 7, 4, 24); /* SY dark */
+
+    if (brightness_has_method(DDC)) /* DDC/CI monitor exists */
+        if (method == DDC)
+            copy_xpm_area(65, 44, 12, 7, 4, 15); /* DC lit */
+        else
+            copy_xpm_area(65, 51, 12, 7, 4, 15); /* DC not lit */
+    else /* DDC/CI not available */
+        copy_xpm_area(65, 58, 12, 7, 4, 15); /* DC dark */
 }
 
 static void draw_percent(void)
@@ -659,9 +701,42 @@ unsigned long get_color(Display *display, char *color_name)
     return color.pixel;
 }
 
+/*
+ * Rebuild the OSD list after the outputs changed
+ *
+ * Windows of outputs that are still in the same place are kept, the
+ * others are created or destroyed as needed.
+ */
 void ui_rrnotify()
 {
-    destroy_osd();
-    new_osd(60);
+    int old_count = dockapp.osd_count;
+    struct osd *old = dockapp.osd;
+
+    if (config.daemon)
+        return;
+    dockapp.osd_count = brightness_get_monitor_count();
+    dockapp.osd = (struct osd *)malloc(sizeof(struct osd) * dockapp.osd_count);
+    for (int i = 0; i < dockapp.osd_count; i++) {
+        struct dimensions dim = brightness_get_dimensions(i+1);
+        const char *name = brightness_get_output_name(i+1);
+        int k;
+
+        for (k = 0; k < old_count; k++) {
+            if (old[k].on && !strcmp(old[k].name, name)
+                && old[k].x == dim.x + 100 && old[k].y == dim.y + dim.height - 120
+                && old[k].width == dim.width - 200)
+                break;
+        }
+        if (k < old_count) {
+            dockapp.osd[i] = old[k];
+            old[k].on = false;
+            old[k].win = 0;
+        } else {
+            create_osd_window(&dockapp.osd[i], i);
+        }
+    }
+    for (int k = 0; k < old_count; k++)
+        destroy_osd_window(&old[k]);
+    free(old);
     ui_update();
 }
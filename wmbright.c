@@ -27,6 +27,10 @@
 #include <string.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
 
 #include <X11/X.h>
 #include <X11/Xlib.h>
@@ -39,6 +43,10 @@
 #include "include/mmkeys.h"
 #include "include/config.h"
 #include "include/brightness.h"
+#include "include/control.h"
+#include "include/state.h"
+#include "include/stream.h"
+#include "include/xinput.h"
 
 
 static Display *display;
@@ -50,26 +58,86 @@ static float display_height;
 static float display_width;
 static int mouse_drag_home_x;
 static int mouse_drag_home_y;
-static int idle_loop;
+static int mouse_drag_last_x;       /* Where the pointer was last seen while dragging */
+static int mouse_drag_last_y;
+static bool warp_pending;           /* The motion of our warp home is still to come */
+static Window mouse_drag_window;
+static float drag_delta;            /* Knob movement not applied yet */
+static bool drag_moved;
+static bool drag_raw;               /* Dragging with XInput 2, no warping */
+static double wheel_delta;          /* Smooth scrolling not applied yet, in wheel clicks */
+static double wheel_applied;        /* When smooth scrolling was last applied */
+static float key_delta;             /* Level change from the keys not applied yet */
+static bool key_pressed;
+static KeyCode key_held;            /* Brightness key being held down, or 0 */
+static int key_repeats;             /* How long it has been held, in repeats */
 static int msg_length;
 
+/* Time between two steps of the scrolling monitor name, in seconds */
+#define SCROLL_INTERVAL 0.1
+
+/* The OSD goes away after this long without activity, in seconds */
+#define OSD_TIMEOUT 1.6
+
+/* The brightness keys step this much more or less with a modifier */
+#define KEY_STEP_FACTOR 3
+
+/* Holding a brightness key adds a step per press every this many
+   repeats, up to KEY_ACCEL_MAX steps */
+#define KEY_ACCEL_REPEATS 8
+#define KEY_ACCEL_MAX 4
+
+/* Smooth scrolling is applied at most this often, in seconds */
+#define WHEEL_INTERVAL (1.0 / 60.0)
+
+/* Things the main loop has to do at some point, on the monotonic clock.
+   0 when there is nothing to do. */
+enum deadline {
+    SCROLL_DEADLINE,
+    OSD_DEADLINE,
+    REINIT_DEADLINE,
+    BRIGHTNESS_DEADLINE,
+    STREAM_DEADLINE,
+    WHEEL_DEADLINE,
+    DEADLINE_COUNT
+};
+static double deadlines[DEADLINE_COUNT];
+
 /* local stuff */
 static void signal_catch(int sig);
+static bool deadline_passed(enum deadline which, double now);
+static void arm_timer(int fd);
+static void start_scroll(void);
+static void osd_activity(void);
+static void control_changed(int changes);
+static int set_level_once(double start_time);
+static void shutdown_all(void);
 static void button_press_event(XButtonEvent *event);
 static void button_release_event(XButtonEvent *event);
 static int  key_press_event(XKeyEvent *event);
+static void key_release_event(XKeyEvent *event);
 static void motion_event(XMotionEvent *event);
+static void apply_drag(void);
+static void apply_wheel(double now);
+static void apply_keys(void);
 
 
 int main(int argc, char **argv)
 {
     XEvent event;
+    double dy, scroll;
     int rr_event_base, rr_error_base;
-    bool need_reinit = false;
+    int merged_events = 0;
+    int timer_fd, signal_fd;
+    struct pollfd fds[3 + 4 + 1 + CONTROL_MAX_CLIENTS];
+    int extra_fds[4 + 1 + CONTROL_MAX_CLIENTS];
+    sigset_t signals;
+    double start_time = get_current_time();
 
     config_init();
     parse_cli_options(argc, argv);
     config_read();
+
     XInitThreads();
     display = XOpenDisplay(config.display_name);
     if (display == NULL) {
@@ -92,7 +160,26 @@ int main(int argc, char **argv)
         fprintf(stderr, "wmbright:error: randr extension not found\n");
         return EXIT_FAILURE;
     }
-    int rr_mask = RROutputChangeNotifyMask; //RRScreenChangeNotifyMask;
+
+    if (config.set_level)
+        return set_level_once(start_time);
+
+    /* up/down and quit signals are read from a file descriptor. Blocked
+       before any thread is started, so that none of them gets them instead. */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGUSR2);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (signal_fd < 0 || timer_fd < 0) {
+        fprintf(stderr, "wmbright:error: Unable to set up the main loop: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    int rr_mask = RROutputChangeNotifyMask | RRCrtcChangeNotifyMask
+        | RROutputPropertyNotifyMask; //RRScreenChangeNotifyMask;
     XRRSelectInput(display,
                    RootWindow(display, DefaultScreen(display)),
                    rr_mask);
@@ -103,94 +190,211 @@ int main(int argc, char **argv)
     display_height = (float)DisplayHeight(display, DefaultScreen(display)) / 2.0;
 
     dockapp_init(display);
-    new_window("wmbright", 64, 64);
-    new_osd(60);
+    if (config.daemon) {
+        /* Nothing to show things on */
+        config.osd = 0;
+    } else {
+        new_window("wmbright", 64, 64);
+        new_osd(60);
+        xinput_init(display, config.verbose);
+    }
 
     if (config.mmkeys)
         mmkey_install(display);
 
+    if (config.control)
+        control_init(config.control_socket, DisplayString(display), config.verbose);
+    if (config.shm)
+        state_init(DisplayString(display), config.verbose);
+    if (config.stream)
+        stream_init();
+
     config_release();
 
     blit_string(brightness_get_monitor_name());
     msg_length = strlen(brightness_get_monitor_name());
-    scroll_text(3, 4, 35, msg_length, true);
+    start_scroll();
     ui_update();
 
     /* add click regions */
     add_region(1, 20, 18, 42, 42);    /* knob */
     add_region(2, 3, 41, 14, 9);      /* backlight indicator */
     add_region(3, 3, 32, 14, 9);      /* gamma indicator */
+    add_region(4, 3, 23, 14, 9);      /* sysfs indicator */
+    add_region(5, 3, 14, 14, 9);      /* DDC/CI indicator */
 
     add_region(8, 3, 50, 7, 10);      /* previous channel */
     add_region(9, 10, 50, 7, 10);     /* next channel */
     add_region(10, 3, 4, 58, 11);     /* re-scroll current channel name */
 
-    /* setup up/down signal handler */
     create_pid_file();
-    signal(SIGUSR1, (void *) signal_catch);
-    signal(SIGUSR2, (void *) signal_catch);
     while (true) {
-        if (button_pressed || slider_pressed || (XPending(display) > 0)) {
+        /* Everything that is already queued first */
+        while (XPending(display) > 0) {
             XNextEvent(display, &event);
             switch (event.type) {
             case KeyPress:
                 if (key_press_event(&event.xkey))
-                    idle_loop = 0;
+                    osd_activity();
+                break;
+            case KeyRelease:
+                key_release_event(&event.xkey);
                 break;
             case Expose:
                 redraw_window();
                 break;
             case ButtonPress:
                 button_press_event(&event.xbutton);
-                idle_loop = 0;
+                osd_activity();
                 break;
             case ButtonRelease:
                 button_release_event(&event.xbutton);
-                idle_loop = 0;
+                osd_activity();
                 break;
             case MotionNotify:
                 /* process cursor change, or drag events */
                 motion_event(&event.xmotion);
-                idle_loop = 0;
+                osd_activity();
+                break;
+            case EnterNotify:
+                xinput_hover(true);
                 break;
             case LeaveNotify:
+                xinput_hover(false);
                 /* go back to standard cursor */
                 if ((!button_pressed) && (!slider_pressed))
                     set_cursor(NORMAL_CURSOR);
                 break;
+            case GenericEvent:
+                if (!xinput_get_motion(&event, &dy, &scroll))
+                    break;
+                if (dy != 0.0 && button_pressed && drag_raw) {
+                    /* Down is positive, like y */
+                    drag_delta -= (float)dy / display_height;
+                    drag_moved = true;
+                    osd_activity();
+                }
+                if (scroll != 0.0 && config.mousewheel) {
+                    /* So is scrolling, unless the wheel buttons are swapped */
+                    if (config.wheel_button_up < config.wheel_button_down)
+                        wheel_delta -= scroll;
+                    else
+                        wheel_delta += scroll;
+                    osd_activity();
+                }
+                break;
             case DestroyNotify:
-                XCloseDisplay(display);
+                shutdown_all();
                 return EXIT_SUCCESS;
             default:
                 if (event.type == rr_event_base + RRNotify) {
                     XRRNotifyEvent *notify = (XRRNotifyEvent *)&event;
-                    if (notify->subtype == RRNotify_OutputChange) {
-                        if (config.verbose)
-                            printf("Outputs changed, reconfiguring.\n");
-                        need_reinit = true;
+                    if ((notify->subtype == RRNotify_OutputChange)
+                        || (notify->subtype == RRNotify_CrtcChange)) {
+                        /* Wait for the burst to settle before reconfiguring */
+                        brightness_screen_changed();
+                        merged_events++;
+                        deadlines[REINIT_DEADLINE] = get_current_time() + config.settle_time / 1000.0;
+                    } else if (notify->subtype == RRNotify_OutputProperty) {
+                        XRROutputPropertyNotifyEvent *prop = (XRROutputPropertyNotifyEvent *)&event;
+                        brightness_property_changed(prop->output, prop->property);
                     }
                     XRRUpdateConfiguration(&event);
                 }
                 break;
             }
-        } else {
-            if (need_reinit) {
-                need_reinit = false;
-                brightness_reinit();
-                ui_rrnotify();
+        }
+        /* All the motion and key presses seen above, in one go */
+        apply_drag();
+        apply_keys();
+
+        double now = get_current_time();
+        deadline_passed(WHEEL_DEADLINE, now);
+        apply_wheel(now);
+        if (deadline_passed(REINIT_DEADLINE, now)) {
+            if (config.verbose)
+                printf("Outputs changed, reconfiguring after %d RandR event(s).\n",
+                       merged_events);
+            merged_events = 0;
+            brightness_reinit();
+            ui_rrnotify();
+            blit_string(brightness_get_monitor_name());
+            msg_length = strlen(brightness_get_monitor_name());
+            start_scroll();
+            continue;
+        }
+        if (deadline_passed(SCROLL_DEADLINE, now)
+            && scroll_text(3, 4, 35, msg_length, false))
+            deadlines[SCROLL_DEADLINE] = now + SCROLL_INTERVAL;
+        /* get rid of OSD after a few seconds of idle, releasing the
+           knob counts as activity */
+        if (deadline_passed(OSD_DEADLINE, now) && osd_mapped() && !button_pressed)
+            unmap_osd();
+        deadline_passed(BRIGHTNESS_DEADLINE, now);
+        if (brightness_is_changed())
+            ui_update();
+        int timeout = brightness_get_timeout();
+        if (timeout >= 0)
+            deadlines[BRIGHTNESS_DEADLINE] = now + timeout / 1000.0;
+
+        state_publish();
+        deadline_passed(STREAM_DEADLINE, now);
+        if (config.stream && !stream_update(now, &deadlines[STREAM_DEADLINE])) {
+            /* Nobody is reading anymore */
+            shutdown_all();
+            return EXIT_SUCCESS;
+        }
+
+        /* Drawing may have read more events, don't sleep on those */
+        XFlush(display);
+        if (XEventsQueued(display, QueuedAlready) > 0)
+            continue;
+
+        arm_timer(timer_fd);
+        fds[0].fd = ConnectionNumber(display);
+        fds[1].fd = timer_fd;
+        fds[2].fd = signal_fd;
+        int n_brightness_fds = brightness_get_fds(extra_fds, 4);
+        int n_control_fds = control_get_fds(extra_fds + n_brightness_fds,
+                                            lengthof(extra_fds) - n_brightness_fds);
+        int n_fds = 3 + n_brightness_fds + n_control_fds;
+        for (int i = 3; i < n_fds; i++)
+            fds[i].fd = extra_fds[i - 3];
+        for (int i = 0; i < n_fds; i++)
+            fds[i].events = POLLIN;
+        if (poll(fds, n_fds, -1) < 0) {
+            if (errno == EINTR)
                 continue;
+            fprintf(stderr, "wmbright:error: poll failed: %s\n", strerror(errno));
+            control_close();
+            state_close();
+            return EXIT_FAILURE;
+        }
+        if (fds[1].revents & POLLIN) {
+            uint64_t expirations;
+            if (read(timer_fd, &expirations, sizeof(expirations)) < 0) {
+                /* Spurious wakeup, the deadlines are checked anyway */
             }
-            usleep(100000);
-            //brightness_tick();
-            scroll_text(3, 4, 35, msg_length, false);
-            /* get rid of OSD after a few seconds of idle */
-            if ((idle_loop++ > 15) && osd_mapped() && !button_pressed) {
-                unmap_osd();
-                idle_loop = -10000;
+        }
+        if (fds[2].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                if (info.ssi_signo == SIGTERM || info.ssi_signo == SIGINT) {
+                    /* Without a window to close, this is how we are told to go */
+                    shutdown_all();
+                    return EXIT_SUCCESS;
+                }
+                signal_catch(info.ssi_signo);
             }
-            if (brightness_is_changed())
-                ui_update();
         }
+        /* Everything the clients sent is applied before redrawing once */
+        bool commands = false;
+        for (int i = 3 + n_brightness_fds; i < n_fds; i++)
+            commands |= fds[i].revents != 0;
+        if (commands)
+            control_changed(control_process());
+        /* The X connection and the brightness backends are dealt with
+           at the top of the loop */
     }
     return EXIT_SUCCESS;
 }
@@ -199,28 +403,208 @@ static void signal_catch(int sig)
 {
     switch (sig) {
     case SIGUSR1:
-        printf("sigusr1\n");
+        if (config.verbose)
+            printf("sigusr1\n");
         brightness_set_level_rel(config.scrollstep);
         if (!osd_mapped())
             map_osd();
         if (osd_mapped())
             update_osd(false);
         ui_update();
-        idle_loop = 0;
+        osd_activity();
         break;
     case SIGUSR2:
-        printf("sigusr2\n");
+        if (config.verbose)
+            printf("sigusr2\n");
         brightness_set_level_rel(-config.scrollstep);
         if (!osd_mapped())
             map_osd();
         if (osd_mapped())
             update_osd(false);
         ui_update();
-        idle_loop = 0;
+        osd_activity();
         break;
     }
 }
 
+/*
+ * Set the level given on the command line and exit
+ *
+ * No windows, no key grabs, and only the output that was asked for is
+ * probed. Levels starting with + or - are relative.
+ */
+static int set_level_once(double start_time)
+{
+    enum method method = NONE;
+    bool relative = config.set_level[0] == '+' || config.set_level[0] == '-';
+    char *end;
+    float value = strtof(config.set_level, &end);
+
+    if (end == config.set_level || (*end != '\0' && strcmp(end, "%") != 0)) {
+        fprintf(stderr, "wmbright:error: level \"%s\" not understood\n", config.set_level);
+        return EXIT_FAILURE;
+    }
+    if (config.set_method && !brightness_parse_method(config.set_method, &method)) {
+        fprintf(stderr, "wmbright:error: unknown method \"%s\"\n", config.set_method);
+        return EXIT_FAILURE;
+    }
+    if (!brightness_init_oneshot(display, config.verbose, (const char **)config.exclude_output,
+                                 config.set_output, method)) {
+        if (config.set_output)
+            fprintf(stderr, "wmbright:error: output \"%s\" not found or not in use\n",
+                    config.set_output);
+        else
+            fprintf(stderr, "wmbright:error: no outputs in use\n");
+        return EXIT_FAILURE;
+    }
+    if (method != NONE && !brightness_set_method(method)) {
+        fprintf(stderr, "wmbright:error: %s can't be controlled through %s\n",
+                brightness_get_monitor_name(), config.set_method);
+        brightness_flush();
+        return EXIT_FAILURE;
+    }
+
+    if (relative) {
+        brightness_ready();
+        brightness_set_level_rel(value / 100.0);
+        brightness_unready();
+    } else {
+        brightness_set_level(CLAMP(value / 100.0, 0.0, 1.0));
+    }
+    brightness_flush();
+    XSync(display, False);
+    if (config.verbose)
+        printf("Level applied %.1f ms after startup\n", (get_current_time() - start_time) * 1000.0);
+    XCloseDisplay(display);
+    return EXIT_SUCCESS;
+}
+
+/* Turn the knob by the motion added up since last time, then warp the
+   pointer back home, once, unless it is grabbed */
+static void apply_drag(void)
+{
+    if (!drag_moved)
+        return;
+    drag_moved = false;
+    if (drag_delta != 0.0) {
+        set_cursor(NULL_CURSOR);
+        knob_turn(drag_delta);
+        drag_delta = 0.0;
+        if (!osd_mapped())
+            map_osd();
+        if (osd_mapped())
+            update_osd(false);
+        osd_activity();
+    }
+    /* Already home, a warp would not move anything and nothing would
+       come back */
+    if (drag_raw || ((mouse_drag_last_x == mouse_drag_home_x)
+                     && (mouse_drag_last_y == mouse_drag_home_y)))
+        return;
+    warp_pending = true;
+    XWarpPointer(display, None, mouse_drag_window, 0, 0, 0, 0,
+                 mouse_drag_home_x, mouse_drag_home_y);
+}
+
+/* Change the level by the smooth scrolling added up since last time,
+   unless that was less than a frame ago */
+static void apply_wheel(double now)
+{
+    if (wheel_delta == 0.0)
+        return;
+    if (now < wheel_applied + WHEEL_INTERVAL) {
+        deadlines[WHEEL_DEADLINE] = wheel_applied + WHEEL_INTERVAL;
+        return;
+    }
+    wheel_applied = now;
+    brightness_ready();
+    brightness_set_level_rel(wheel_delta * config.scrollstep);
+    brightness_unready();
+    wheel_delta = 0.0;
+    if (!osd_mapped())
+        map_osd();
+    if (osd_mapped())
+        update_osd(false);
+    ui_update();
+    osd_activity();
+}
+
+/* Apply what is pending and let go of everything outside the process */
+static void shutdown_all(void)
+{
+    control_close();
+    state_close();
+    brightness_flush();
+    XCloseDisplay(display);
+}
+
+/* Catch up with what commands from the control socket did */
+static void control_changed(int changes)
+{
+    if (changes & CONTROL_OUTPUT) {
+        blit_string(brightness_get_monitor_name());
+        msg_length = strlen(brightness_get_monitor_name());
+        start_scroll();
+    }
+    if (changes & (CONTROL_OUTPUT | CONTROL_METHOD)) {
+        unmap_osd();
+        map_osd();
+    } else if (changes & CONTROL_LEVEL) {
+        if (!osd_mapped())
+            map_osd();
+        if (osd_mapped())
+            update_osd(false);
+    }
+    if (changes) {
+        ui_update();
+        osd_activity();
+    }
+}
+
+/* Returns true, once, if a deadline has passed */
+static bool deadline_passed(enum deadline which, double now)
+{
+    if (deadlines[which] == 0.0 || deadlines[which] > now)
+        return false;
+    deadlines[which] = 0.0;
+    return true;
+}
+
+/* Make the timer go off at the earliest deadline, or never */
+static void arm_timer(int fd)
+{
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+    double next = 0.0;
+
+    for (int i = 0; i < DEADLINE_COUNT; i++) {
+        if (deadlines[i] != 0.0 && (next == 0.0 || deadlines[i] < next))
+            next = deadlines[i];
+    }
+    if (next != 0.0) {
+        its.it_value.tv_sec = next;
+        its.it_value.tv_nsec = (next - its.it_value.tv_sec) * 1.0e9;
+        /* All zero would disarm it */
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+            its.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* Show the name of the monitor from the start, scrolling if needed */
+static void start_scroll(void)
+{
+    if (scroll_text(3, 4, 35, msg_length, true))
+        deadlines[SCROLL_DEADLINE] = get_current_time() + SCROLL_INTERVAL;
+    else
+        deadlines[SCROLL_DEADLINE] = 0.0;
+}
+
+/* Keep the OSD up for a while longer */
+static void osd_activity(void)
+{
+    deadlines[OSD_DEADLINE] = get_current_time() + OSD_TIMEOUT;
+}
+
 static void button_press_event(XButtonEvent *event)
 {
     double button_press_time = get_current_time();
@@ -230,6 +614,11 @@ static void button_press_event(XButtonEvent *event)
 
     /* handle wheel scrolling to adjust level */
     if (config.mousewheel) {
+        if ((event->button == config.wheel_button_up || event->button == config.wheel_button_down)
+            && xinput_is_emulated(event->time)) {
+            /* Already counted as smooth scrolling */
+            return;
+        }
         if (event->button == config.wheel_button_up) {
             brightness_ready();
             brightness_set_level_rel(config.scrollstep);
@@ -239,7 +628,7 @@ static void button_press_event(XButtonEvent *event)
             if (osd_mapped())
                 update_osd(false);
             ui_update();
-            idle_loop = 0;
+            osd_activity();
             return;
         }
         if (event->button == config.wheel_button_down) {
@@ -251,7 +640,7 @@ static void button_press_event(XButtonEvent *event)
             if (osd_mapped())
                 update_osd(false);
             ui_update();
-            idle_loop = 0;
+            osd_activity();
             return;
         }
     }
@@ -269,13 +658,21 @@ static void button_press_event(XButtonEvent *event)
         slider_pressed = false;
         mouse_drag_home_x = x;
         mouse_drag_home_y = y;
+        mouse_drag_last_x = x;
+        mouse_drag_last_y = y;
+        warp_pending = false;
+        drag_delta = 0.0;
+        drag_moved = false;
+        drag_raw = xinput_drag_start(event->window, event->time);
+        if (drag_raw)
+            set_cursor(NULL_CURSOR);
         break;
     case 2:            /* backlight indicator */
         if (brightness_set_method(BACKLIGHT)) {
             unmap_osd();
             map_osd();
             ui_update();
-            idle_loop = 0;
+            osd_activity();
         }
         break;
     case 3:            /* gamma indicator */
@@ -283,30 +680,46 @@ static void button_press_event(XButtonEvent *event)
             unmap_osd();
             map_osd();
             ui_update();
-            idle_loop = 0;
+            osd_activity();
+        }
+        break;
+    case 4:            /* sysfs indicator */
+        if (brightness_set_method(SYSFS)) {
+            unmap_osd();
+            map_osd();
+            ui_update();
+            osd_activity();
+        }
+        break;
+    case 5:            /* DDC/CI indicator */
+        if (brightness_set_method(DDC)) {
+            unmap_osd();
+            map_osd();
+            ui_update();
+            osd_activity();
         }
         break;
    case 8:            /* previous monitor */
         brightness_set_monitor_rel(-1); 
         blit_string(brightness_get_monitor_name());
         msg_length = strlen(brightness_get_monitor_name());
-        scroll_text(3, 4, 35, msg_length, true);
+        start_scroll();
         unmap_osd();
         map_osd();
         ui_update();
-        idle_loop = 0;
+        osd_activity();
         break;
     case 9:            /* next monitor */
         brightness_set_monitor_rel(1);
         blit_string(brightness_get_monitor_name());
         msg_length = strlen(brightness_get_monitor_name());
-        scroll_text(3, 4, 35, msg_length, true);
+        start_scroll();
         unmap_osd();
         map_osd();
         ui_update();
         break;
     case 10:
-        scroll_text(3, 4, 35, msg_length, true);
+        start_scroll();
         break;
     default:
         //printf("unknown region pressed\n");
@@ -316,29 +729,60 @@ static void button_press_event(XButtonEvent *event)
 
 static int key_press_event(XKeyEvent *event)
 {
-    if (event->keycode == mmkeys.brightness_up) {
-        brightness_set_level_rel(config.scrollstep);
-        if (!osd_mapped())
-            map_osd();
-        if (osd_mapped())
-            update_osd(false);
-        ui_update();
-        idle_loop = 0;
-        return 1;
+    float step = config.scrollstep;
+
+    if ((event->keycode != mmkeys.brightness_up) && (event->keycode != mmkeys.brightness_down)) {
+        /* Ignore other keys */
+        return 0;
     }
-    if (event->keycode == mmkeys.brightness_down) {
-        brightness_set_level_rel(-config.scrollstep);
-        if (!osd_mapped())
-            map_osd();
-        if (osd_mapped())
-            update_osd(false);
-        ui_update();
-        idle_loop = 0;
-        return 1;
+
+    /* With detectable autorepeat, a repeat is a press without a release */
+    if (event->keycode == key_held) {
+        key_repeats++;
+    } else {
+        key_held = event->keycode;
+        key_repeats = 0;
     }
 
-    /* Ignore other keys */
-    return 0;
+    if (event->state & MMKEY_FINE_MASK) {
+        step /= KEY_STEP_FACTOR;
+    } else {
+        if (event->state & MMKEY_COARSE_MASK)
+            step *= KEY_STEP_FACTOR;
+        /* A tap is one step, a long hold goes faster */
+        step *= MIN(1 + key_repeats / KEY_ACCEL_REPEATS, KEY_ACCEL_MAX);
+    }
+
+    /* Only added up here, apply_keys() does the work once for all the
+       events that were queued */
+    if (event->keycode == mmkeys.brightness_up)
+        key_delta += step;
+    else
+        key_delta -= step;
+    key_pressed = true;
+    return 1;
+}
+
+static void key_release_event(XKeyEvent *event)
+{
+    if (event->keycode == key_held)
+        key_held = 0;
+}
+
+/* Change the level by the key presses added up since last time */
+static void apply_keys(void)
+{
+    if (!key_pressed)
+        return;
+    key_pressed = false;
+    brightness_set_level_rel(key_delta);
+    key_delta = 0.0;
+    if (!osd_mapped())
+        map_osd();
+    if (osd_mapped())
+        update_osd(false);
+    ui_update();
+    osd_activity();
 }
 
 static void button_release_event(XButtonEvent *event)
@@ -347,6 +791,13 @@ static void button_release_event(XButtonEvent *event)
     int y = event->y;
     int region;
 
+    /* Whatever the knob was turned before letting go counts */
+    apply_drag();
+    if (drag_raw) {
+        xinput_drag_stop(event->time);
+        drag_raw = false;
+    }
+
     region = check_region(x, y);
 
     if (region == 1)
@@ -365,29 +816,30 @@ static void motion_event(XMotionEvent *event)
     int y = event->y;
     int region;
 
-    if ((x == mouse_drag_home_x) && (y == mouse_drag_home_y))
+    if (button_pressed && drag_raw) {
+        /* The raw events are used instead */
         return;
+    }
+
+    if (button_pressed && warp_pending
+        && (x == mouse_drag_home_x) && (y == mouse_drag_home_y)) {
+        /* Our own warp home, not a movement */
+        warp_pending = false;
+        mouse_drag_last_x = x;
+        mouse_drag_last_y = y;
+        return;
+    }
 
     region = check_region(x, y);
 
     if (button_pressed) {
-        if (y != mouse_drag_home_y) {
-            float delta;
-
-            set_cursor(NULL_CURSOR);
-
-            delta = (float)(mouse_drag_home_y - y) / display_height;
-
-            knob_turn(delta);
-
-            if (!osd_mapped())
-                map_osd();
-            if (osd_mapped())
-                update_osd(false);
-            idle_loop = 0;
-        }
-        XWarpPointer(display, None, event->window, x, y, 0, 0,
-                     mouse_drag_home_x, mouse_drag_home_y);
+        /* Only added up here, apply_drag() does the work once for all
+           the events that were queued */
+        drag_delta += (float)(mouse_drag_last_y - y) / display_height;
+        mouse_drag_last_x = x;
+        mouse_drag_last_y = y;
+        mouse_drag_window = event->window;
+        drag_moved = true;
         return;
     }
 
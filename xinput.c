@@ -0,0 +1,259 @@
+/* wmbright -- a brightness control using randr.
+ * Copyright (C) 2019
+ *     Johannes Holmberg <johannes@update.uu.se>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+/*
+ * xinput.c: pointer input through XInput 2
+ *
+ * The knob is turned by dragging it up or down. With the core protocol
+ * that means warping the pointer back after every motion event, which
+ * doubles the event traffic, gets in the way of pointer acceleration and
+ * goes wrong on remote displays. With XI2, the pointer is grabbed and
+ * confined to the dockapp instead, with the cursor hidden, and the raw
+ * movement of the device turns the knob.
+ *
+ * From XI 2.1 on, touchpads and free spinning wheels also report how far
+ * they scrolled on a scroll valuator, finer than the wheel buttons the
+ * core protocol turns that into.
+ *
+ * Raw events only arrive while the pointer is over the dockapp or a drag
+ * is going on, so nothing wakes us up otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <X11/Xlib.h>
+#include <X11/extensions/XInput2.h>
+
+#include "include/common.h"
+#include "include/xinput.h"
+
+
+/* How a device reports vertical movement */
+struct device_axis {
+    int deviceid;
+    int number;                     /* Valuator of the Y axis */
+    bool absolute;                  /* Tablets and touchscreens */
+    double min, max;
+    double last;                    /* Last absolute value seen in this drag */
+    bool have_last;
+    int scroll_number;              /* Valuator of vertical scrolling, or -1 */
+    double scroll_increment;        /* How much of it is one wheel click */
+};
+
+/* Devices seen so far, few machines have more */
+#define MAX_DEVICES 16
+
+/* Wheel buttons the server makes up from scrolling come right after it,
+   in milliseconds */
+#define EMULATION_SLACK 50
+
+static Display *display;
+static int xi_opcode = -1;
+static bool smooth_scroll = false;
+static struct device_axis devices[MAX_DEVICES];
+static int n_devices = 0;
+static bool dragging = false;
+static bool hovering = false;
+static bool raw_selected = false;
+static bool scrolled = false;
+static Time last_scroll_time;
+
+
+bool xinput_init(Display *x_display, bool verbose)
+{
+    int event, error;
+    int major = 2, minor = 2;
+
+    display = x_display;
+    if (!XQueryExtension(display, "XInputExtension", &xi_opcode, &event, &error)) {
+        xi_opcode = -1;
+        return false;
+    }
+    if (XIQueryVersion(display, &major, &minor) != Success || major < 2) {
+        xi_opcode = -1;
+        return false;
+    }
+    smooth_scroll = major > 2 || minor >= 1;
+    if (verbose)
+        printf("Using XInput %d.%d for the knob%s\n", major, minor,
+               smooth_scroll ? " and smooth scrolling" : "");
+    return true;
+}
+
+/* Find out which valuators of a device move it up and down */
+static struct device_axis *get_device_axis(int deviceid)
+{
+    struct device_axis *axis = NULL;
+    XIDeviceInfo *info;
+    bool found_y = false;
+    int n;
+
+    for (int i = 0; i < n_devices; i++) {
+        if (devices[i].deviceid == deviceid)
+            return &devices[i];
+    }
+    if (n_devices < MAX_DEVICES)
+        axis = &devices[n_devices++];
+    else
+        axis = &devices[deviceid % MAX_DEVICES];
+
+    axis->deviceid = deviceid;
+    axis->number = 1;
+    axis->absolute = false;
+    axis->min = axis->max = 0.0;
+    axis->have_last = false;
+    axis->scroll_number = -1;
+    axis->scroll_increment = 0.0;
+
+    info = XIQueryDevice(display, deviceid, &n);
+    if (!info)
+        return axis;
+    Atom rel_y = XInternAtom(display, "Rel Y", True);
+    Atom abs_y = XInternAtom(display, "Abs Y", True);
+    for (int i = 0; i < info->num_classes; i++) {
+        if (info->classes[i]->type == XIScrollClass) {
+            XIScrollClassInfo *s = (XIScrollClassInfo *)info->classes[i];
+            if (s->scroll_type == XIScrollTypeVertical && s->increment != 0.0) {
+                axis->scroll_number = s->number;
+                axis->scroll_increment = s->increment;
+            }
+            continue;
+        }
+        if (info->classes[i]->type != XIValuatorClass || found_y)
+            continue;
+        XIValuatorClassInfo *v = (XIValuatorClassInfo *)info->classes[i];
+        /* Unlabelled devices put Y second, like everyone else */
+        if ((v->label != None && (v->label == rel_y || v->label == abs_y))
+            || (v->label == None && v->number == 1)) {
+            axis->number = v->number;
+            axis->absolute = v->mode != XIModeRelative;
+            axis->min = v->min;
+            axis->max = v->max;
+            found_y = true;
+        }
+    }
+    XIFreeDeviceInfo(info);
+    return axis;
+}
+
+/* Ask for raw motion if anything needs it, and stop asking otherwise */
+static void update_selection(void)
+{
+    unsigned char bits[XIMaskLen(XI_RawMotion)];
+    XIEventMask mask;
+    bool wanted = dragging || (hovering && smooth_scroll);
+
+    if (wanted == raw_selected)
+        return;
+    raw_selected = wanted;
+
+    memset(bits, 0, sizeof(bits));
+    if (wanted)
+        XISetMask(bits, XI_RawMotion);
+    mask.deviceid = XIAllMasterDevices;
+    mask.mask_len = sizeof(bits);
+    mask.mask = bits;
+    /* Raw events are only ever sent to the root window */
+    XISelectEvents(display, DefaultRootWindow(display), &mask, 1);
+}
+
+bool xinput_drag_start(Window window, Time time)
+{
+    if (xi_opcode < 0)
+        return false;
+    if (XGrabPointer(display, window, False,
+                     ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
+                     GrabModeAsync, GrabModeAsync, window, None, time) != GrabSuccess)
+        return false;
+    for (int i = 0; i < n_devices; i++)
+        devices[i].have_last = false;
+    dragging = true;
+    update_selection();
+    return true;
+}
+
+void xinput_drag_stop(Time time)
+{
+    dragging = false;
+    update_selection();
+    XUngrabPointer(display, time);
+}
+
+void xinput_hover(bool inside)
+{
+    if (xi_opcode < 0)
+        return;
+    hovering = inside;
+    update_selection();
+}
+
+bool xinput_get_motion(XEvent *event, double *dy, double *scroll)
+{
+    XGenericEventCookie *cookie = &event->xcookie;
+    bool found = false;
+
+    *dy = 0.0;
+    *scroll = 0.0;
+    if (xi_opcode < 0 || cookie->type != GenericEvent || cookie->extension != xi_opcode)
+        return false;
+    if (!XGetEventData(display, cookie))
+        return false;
+    if (cookie->evtype == XI_RawMotion) {
+        XIRawEvent *raw = (XIRawEvent *)cookie->data;
+        struct device_axis *axis = get_device_axis(raw->sourceid ? raw->sourceid : raw->deviceid);
+        double *value = raw->raw_values;
+
+        /* Only the valuators that changed are there, in order */
+        for (int i = 0; i < raw->valuators.mask_len * 8; i++) {
+            if (!XIMaskIsSet(raw->valuators.mask, i))
+                continue;
+            if (i == axis->scroll_number) {
+                /* In wheel clicks, down is positive */
+                *scroll = *value / axis->scroll_increment;
+                scrolled = true;
+                last_scroll_time = raw->time;
+                found = true;
+            } else if (i == axis->number && dragging) {
+                if (!axis->absolute) {
+                    *dy = *value;
+                    found = true;
+                } else {
+                    /* Scaled so that the height of the device is that of the screen */
+                    if (axis->have_last && axis->max > axis->min) {
+                        *dy = (*value - axis->last) * DisplayHeight(display, DefaultScreen(display))
+                            / (axis->max - axis->min);
+                        found = true;
+                    }
+                    axis->last = *value;
+                    axis->have_last = true;
+                }
+            }
+            value++;
+        }
+    }
+    XFreeEventData(display, cookie);
+    return found;
+}
+
+bool xinput_is_emulated(Time time)
+{
+    /* Core events don't say whether they were made up, going by time will do */
+    return scrolled && time >= last_scroll_time && time - last_scroll_time <= EMULATION_SLACK;
+}